@@ -0,0 +1,311 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Benchmark sweep over element count, thread count, element type and scan variant
+ *
+ * Each case is validated once and then timed for a number of repetitions; median, minimum and
+ * 95th percentile are reported together with the effective read+write bandwidth of the median
+ * and its fraction of a STREAM-style copy bandwidth measured with the same thread count. The
+ * TBB std::execution::par scan is included as a baseline. Results are written as CSV or JSON.
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <execution>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+#include <tbb/global_control.h>
+
+#include "scan.hpp"
+#include "scan_reproducible.hpp"
+#include "scan_simd.hpp"
+#include "scan_tune.hpp"
+#include "scan_v1.hpp"
+#include "scan_v2.hpp"
+#include "scan_v3.hpp"
+#include "scan_v4.hpp"
+
+struct Options
+{
+    std::size_t minBytes = 4096;
+    std::size_t maxBytes = 8 * simd::llcSize();
+    std::vector<int> threads;
+    std::vector<std::string> types{"u32", "u64", "f64"};
+    std::vector<std::string> variants;
+    int repetitions = 15;
+    bool json       = false;
+    std::string output;
+};
+
+struct Result
+{
+    std::string type, variant;
+    int threads;
+    std::size_t elements, bytes;
+    double minTime, medianTime, p95Time, bandwidth, roofline;
+    bool valid;
+};
+
+template<class T>
+void exclusiveScanSerial(const T* in, T* out, std::size_t numElements)
+{
+    simd::exclusiveScan(in, out, numElements, T(0));
+}
+
+template<class T>
+void exclusiveScanFrontEnd(const T* in, T* out, std::size_t numElements)
+{
+    scan::exclusiveScan(in, out, numElements, T(0));
+}
+
+template<class T>
+void exclusiveScanReproducible(const T* in, T* out, std::size_t numElements)
+{
+    scan::reproducibleExclusiveScan(in, out, numElements, T(0));
+}
+
+template<class T>
+void exclusiveScanTBB(const T* in, T* out, std::size_t numElements)
+{
+    std::exclusive_scan(std::execution::par, in, in + numElements, out, T(0));
+}
+
+template<class T>
+std::vector<scan::ScanCandidate<T>> benchVariants()
+{
+    return {{"serial", 0, exclusiveScanSerial<T>},
+            {"v1", scan::blockPages, v1::exclusiveScan<T, scan::blockPages>},
+            {"v2", scan::blockPages, v2::exclusiveScan<T, scan::blockPages>},
+            {"v3", 0, v3::exclusiveScan<T>},
+            {"v3rts", 0, v3::reduceThenScan<T>},
+            {"v4", 5, v4::exclusiveScan<T, 5>},
+            {"frontend", 0, exclusiveScanFrontEnd<T>},
+            {"reproducible", 0, exclusiveScanReproducible<T>},
+            {"tbb", 0, exclusiveScanTBB<T>}};
+}
+
+//! \brief STREAM copy bandwidth (2 words moved per element) with the current OpenMP thread count
+double copyBandwidth(std::size_t bytes, int repetitions)
+{
+    std::size_t n = bytes / sizeof(double);
+    std::vector<double> a(n), b(n);
+
+    #pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        a[i] = 1.0;
+        b[i] = 0.0;
+    }
+
+    double best = 0;
+    for (int r = 0; r < repetitions; ++r)
+    {
+        auto tp0 = std::chrono::high_resolution_clock::now();
+        #pragma omp parallel for schedule(static)
+        for (std::size_t i = 0; i < n; ++i)
+            b[i] = a[i];
+        auto tp1 = std::chrono::high_resolution_clock::now();
+
+        double t = std::chrono::duration<double>(tp1 - tp0).count();
+        if (r == 0 || t < best) { best = t; }
+    }
+    return 2.0 * n * sizeof(double) / best;
+}
+
+//! \brief the value at fraction \a q of the sorted \a times
+double percentile(const std::vector<double>& times, double q)
+{
+    std::size_t idx = std::min(times.size() - 1, std::size_t(q * (times.size() - 1) + 0.5));
+    return times[idx];
+}
+
+template<class T>
+void benchmarkType(const std::string& type, const Options& opt, int threads, double roofline, std::vector<Result>& results)
+{
+    std::size_t maxElements = opt.maxBytes / sizeof(T);
+    std::unique_ptr<T[]> in(new T[maxElements]);
+    std::unique_ptr<T[]> out(new T[maxElements]);
+
+    #pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < maxElements; ++i)
+    {
+        in[i]  = T(i % 3);
+        out[i] = T(0);
+    }
+
+    for (const auto& variant : benchVariants<T>())
+    {
+        bool selected = opt.variants.empty() ||
+                        std::find(opt.variants.begin(), opt.variants.end(), variant.variant) != opt.variants.end();
+        if (!selected || (variant.variant == "serial" && threads > 1)) { continue; }
+
+        for (std::size_t bytes = opt.minBytes; bytes <= opt.maxBytes; bytes *= 4)
+        {
+            std::size_t n = bytes / sizeof(T);
+
+            variant.func(in.get(), out.get(), n);
+            bool valid = true;
+            T sum      = 0;
+            for (std::size_t i = 0; i < n && valid; ++i)
+            {
+                valid = (out[i] == sum);
+                sum += in[i];
+            }
+
+            std::vector<double> times(opt.repetitions);
+            for (auto& t : times)
+            {
+                auto tp0 = std::chrono::high_resolution_clock::now();
+                variant.func(in.get(), out.get(), n);
+                auto tp1 = std::chrono::high_resolution_clock::now();
+                t        = std::chrono::duration<double>(tp1 - tp0).count();
+            }
+            std::sort(times.begin(), times.end());
+
+            double median = percentile(times, 0.5);
+            double moved  = 2.0 * n * sizeof(T);
+            results.push_back({type, variant.variant, threads, n, n * sizeof(T), times.front(), median,
+                               percentile(times, 0.95), moved / median, roofline, valid});
+
+            std::cerr << type << " " << variant.variant << " threads " << threads << " elements " << n << ": "
+                      << moved / median / 1e9 << " GB/s" << (valid ? "" : " INVALID") << "\n";
+        }
+    }
+}
+
+void writeCsv(std::ostream& out, const std::vector<Result>& results)
+{
+    out << "type,variant,threads,elements,bytes,min_s,median_s,p95_s,rw_gbs,roofline_gbs,roofline_fraction,valid\n";
+    for (const auto& r : results)
+    {
+        out << r.type << "," << r.variant << "," << r.threads << "," << r.elements << "," << r.bytes << "," << r.minTime
+            << "," << r.medianTime << "," << r.p95Time << "," << r.bandwidth / 1e9 << "," << r.roofline / 1e9 << ","
+            << r.bandwidth / r.roofline << "," << (r.valid ? "true" : "false") << "\n";
+    }
+}
+
+void writeJson(std::ostream& out, const std::vector<Result>& results)
+{
+    out << "[\n";
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+        const auto& r = results[i];
+        out << "  {\"type\": \"" << r.type << "\", \"variant\": \"" << r.variant << "\", \"threads\": " << r.threads
+            << ", \"elements\": " << r.elements << ", \"bytes\": " << r.bytes << ", \"min_s\": " << r.minTime
+            << ", \"median_s\": " << r.medianTime << ", \"p95_s\": " << r.p95Time << ", \"rw_gbs\": " << r.bandwidth / 1e9
+            << ", \"roofline_gbs\": " << r.roofline / 1e9 << ", \"roofline_fraction\": " << r.bandwidth / r.roofline
+            << ", \"valid\": " << (r.valid ? "true" : "false") << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+}
+
+template<class T>
+std::vector<T> parseList(const std::string& arg)
+{
+    std::vector<T> list;
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        if constexpr (std::is_same_v<T, int>) { list.push_back(std::stoi(item)); }
+        else { list.push_back(item); }
+    }
+    return list;
+}
+
+void usage(const char* name)
+{
+    std::cout << "usage: " << name << " [--json] [--output file] [--min-bytes n] [--max-bytes n] [--threads 1,2,..]\n"
+              << "       [--types u32,u64,f64] [--variants serial,v1,v2,v3,v3rts,v4,frontend,reproducible,tbb] [--repetitions n]\n";
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue   = i + 1 < argc;
+        if (arg == "--json") { opt.json = true; }
+        else if (arg == "--output" && hasValue) { opt.output = argv[++i]; }
+        else if (arg == "--min-bytes" && hasValue) { opt.minBytes = std::stoull(argv[++i]); }
+        else if (arg == "--max-bytes" && hasValue) { opt.maxBytes = std::stoull(argv[++i]); }
+        else if (arg == "--threads" && hasValue) { opt.threads = parseList<int>(argv[++i]); }
+        else if (arg == "--types" && hasValue) { opt.types = parseList<std::string>(argv[++i]); }
+        else if (arg == "--variants" && hasValue) { opt.variants = parseList<std::string>(argv[++i]); }
+        else if (arg == "--repetitions" && hasValue) { opt.repetitions = std::max(1, std::stoi(argv[++i])); }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    int maxThreads = omp_get_max_threads();
+    if (opt.threads.empty())
+    {
+        for (int t = 1; t < maxThreads; t *= 2)
+            opt.threads.push_back(t);
+        opt.threads.push_back(maxThreads);
+    }
+
+    std::vector<Result> results;
+    for (int threads : opt.threads)
+    {
+        omp_set_num_threads(threads);
+        tbb::global_control tbbThreads(tbb::global_control::max_allowed_parallelism, threads);
+
+        double roofline = copyBandwidth(std::max(4 * simd::llcSize(), std::size_t(64) << 20), 5);
+        std::cerr << "threads " << threads << ": copy roofline " << roofline / 1e9 << " GB/s\n";
+
+        for (const auto& type : opt.types)
+        {
+            if (type == "u32") { benchmarkType<uint32_t>(type, opt, threads, roofline, results); }
+            else if (type == "u64") { benchmarkType<uint64_t>(type, opt, threads, roofline, results); }
+            else if (type == "f64") { benchmarkType<double>(type, opt, threads, roofline, results); }
+            else { std::cerr << "unknown element type " << type << "\n"; }
+        }
+    }
+
+    std::ofstream file;
+    if (!opt.output.empty()) { file.open(opt.output); }
+    std::ostream& out = opt.output.empty() ? std::cout : file;
+
+    if (opt.json) { writeJson(out, results); }
+    else { writeCsv(out, results); }
+
+    bool allValid = std::all_of(results.begin(), results.end(), [](const Result& r) { return r.valid; });
+    return allValid ? 0 : 1;
+}
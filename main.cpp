@@ -28,18 +28,40 @@
  * \author Sebastian Keller <sebastian.f.keller@gmail.com>
  */
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <numeric>
 #include <stdlib.h>
 #include <string>
 #include <vector>
 
+#include "scan.hpp"
+#include "scan_2d.hpp"
+#include "scan_async.hpp"
+#include "scan_chunked.hpp"
+#include "scan_file.hpp"
+#include "scan_multi.hpp"
+#include "scan_op.hpp"
+#include "scan_packed.hpp"
+#include "scan_primitives.hpp"
+#include "scan_profile.hpp"
+#include "scan_reproducible.hpp"
+#include "scan_segmented.hpp"
 #include "scan_stl.hpp"
+#include "scan_transform.hpp"
 #include "scan_v1.hpp"
 #include "scan_v2.hpp"
 #include "scan_v3.hpp"
+#include "scan_v4.hpp"
+#include "scan_tune.hpp"
 #include "test.hpp"
 
 template<class T>
@@ -67,20 +89,632 @@ void exclusiveScanParallelInplace(const T* in, T* out, std::size_t num_elements)
     v1::exclusiveScan<T, NPages>(out, num_elements);
 }
 
+template<class T, int NPages>
+void exclusiveScanV2Inplace(const T* in, T* out, std::size_t num_elements)
+{
+    v2::exclusiveScan<T, NPages>(out, num_elements);
+}
+
+template<class T>
+void exclusiveScanV3Inplace(const T* in, T* out, std::size_t num_elements)
+{
+    v3::exclusiveScan(out, num_elements);
+}
+
+//! \brief reduce-then-scan with \a in and \a out aliased, which must not use streaming stores
+template<class T>
+void reduceThenScanInplace(const T* in, T* out, std::size_t num_elements)
+{
+    v3::reduceThenScan(out, out, num_elements);
+}
+
+//! \brief v3 with a persistent context, called from inside a parallel region
+template<class T>
+void exclusiveScanOrphaned(const T* in, T* out, std::size_t num_elements)
+{
+    static scan::ScanContext<T> ctx;
+
+    #pragma omp parallel num_threads(ctx.numThreads())
+    {
+        v3::exclusiveScan(ctx, in, out, num_elements);
+    }
+}
+
+template<class T>
+void exclusiveScanFrontEnd(const T* in, T* out, std::size_t num_elements)
+{
+    scan::exclusiveScan(in, out, num_elements, T(0));
+}
+
+//! \brief check the front end with non-zero init against the serial scan, in- and out-of-place, for edge sizes
+bool test_edge_sizes(int numThreads)
+{
+    std::vector<std::size_t> sizes{0, 1, 2, 3, 63, 64, 65, 4095, 4096, 4097, 100001, 1000003};
+    for (int t = 1; t < 2 * numThreads; ++t)
+        sizes.push_back(t);
+
+    bool pass = true;
+    for (std::size_t n : sizes)
+    {
+        std::vector<uint64_t> in(n), out(n), inplace(n), ref(n);
+        for (std::size_t i = 0; i < n; ++i)
+            in[i] = i % 7;
+
+        stl::exclusive_scan(in.begin(), in.end(), ref.begin(), uint64_t(42));
+
+        scan::exclusiveScan(in.data(), out.data(), n, uint64_t(42));
+        inplace = in;
+        scan::exclusiveScan(inplace.data(), inplace.data(), n, uint64_t(42));
+
+        pass = pass && (out == ref) && (inplace == ref);
+    }
+    std::cout << "front end edge sizes test: " << (pass ? "PASS" : "FAIL") << "\n";
+    return pass;
+}
+
+//! \brief check the in-place scans for a floating-point type, the values are multiples of 1/4 so that all sums are exact
+bool test_inplace_float(std::size_t numElements)
+{
+    std::vector<double> in(numElements), ref(numElements);
+    for (std::size_t i = 0; i < numElements; ++i)
+        in[i] = 0.25 * (i % 7) + 0.5;
+    stl::exclusive_scan(in.begin(), in.end(), ref.begin(), 0.0);
+
+    std::vector<double> frontEnd = in, interleaved = in, shifted = in;
+    scan::exclusiveScan(frontEnd.data(), frontEnd.data(), numElements, 0.0);
+    v2::exclusiveScan<double, scan::blockPages>(interleaved.data(), numElements);
+    v3::exclusiveScan(shifted.data(), numElements);
+
+    bool pass = (frontEnd == ref) && (interleaved == ref) && (shifted == ref);
+    std::cout << "in-place floating-point scan test: " << (pass ? "PASS" : "FAIL") << "\n";
+    return pass;
+}
+
+//! \brief check the segmented scan with head flags and with segment offsets against a serial reference
+bool test_segmented(std::size_t numElements)
+{
+    std::vector<unsigned> in(numElements, 1), outFlags(numElements), outOffsets(numElements), ref(numElements);
+
+    // segments of varying length, some spanning many blocks
+    std::vector<char> flags(numElements, 0);
+    std::vector<std::size_t> offsets;
+    for (std::size_t i = 0, len = 1; i < numElements; i += len, len = (len * 7 + 3) % 200003)
+    {
+        flags[i] = 1;
+        offsets.push_back(i);
+    }
+
+    unsigned sum = 0;
+    for (std::size_t i = 0; i < numElements; ++i)
+    {
+        if (flags[i]) sum = 0;
+        ref[i] = sum;
+        sum += in[i];
+    }
+
+    scan::segmentedExclusiveScan(in.data(), outFlags.data(), numElements, flags.data());
+    scan::segmentedExclusiveScan(in.data(), outOffsets.data(), numElements, offsets.data(), offsets.size());
+
+    bool pass = (outFlags == ref) && (outOffsets == ref);
+    std::cout << "segmented scan test: " << (pass ? "PASS" : "FAIL") << "\n";
+    return pass;
+}
+
+//! \brief check the batched scan of many arrays of varying length, including empty ones, against a serial reference
+bool test_batched(std::size_t numElements)
+{
+    std::vector<std::size_t> offsets{0};
+    for (std::size_t len = 0; offsets.back() + len <= numElements; len = (len * 13 + 5) % 5003)
+        offsets.push_back(offsets.back() + len);
+    offsets.back() = numElements;
+
+    std::size_t numArrays = offsets.size() - 1;
+
+    std::vector<unsigned> in(numElements, 1), out(numElements), ref(numElements);
+    for (std::size_t a = 0; a < numArrays; ++a)
+        stl::exclusive_scan(in.begin() + offsets[a], in.begin() + offsets[a + 1], ref.begin() + offsets[a], 0u);
+
+    scan::batchedExclusiveScan(in.data(), out.data(), offsets.data(), numArrays);
+
+    bool pass = (out == ref);
+    std::cout << "batched scan test (" << numArrays << " arrays): " << (pass ? "PASS" : "FAIL") << "\n";
+    return pass;
+}
+
+//! \brief check the pipelined chunked scan against a scan of the whole sequence
+bool test_chunked(std::size_t numElements)
+{
+    std::vector<uint64_t> in(numElements), out(numElements), ref(numElements);
+    std::iota(in.begin(), in.end(), 0);
+    stl::exclusive_scan(in.begin(), in.end(), ref.begin(), uint64_t(7));
+
+    std::size_t chunkSize = numElements / 7 + 1;
+    std::size_t filled = 0, drained = 0;
+
+    auto fill = [&](uint64_t* buffer, std::size_t capacity)
+    {
+        std::size_t n = std::min(capacity, numElements - filled);
+        std::copy(in.begin() + filled, in.begin() + filled + n, buffer);
+        filled += n;
+        return n;
+    };
+    auto drain = [&](const uint64_t* buffer, std::size_t n)
+    {
+        std::copy(buffer, buffer + n, out.begin() + drained);
+        drained += n;
+    };
+
+    uint64_t total = scan::pipelinedExclusiveScan(fill, drain, chunkSize, uint64_t(7));
+
+    bool pass = (out == ref) && (drained == numElements) && (total == ref.back() + in.back());
+    std::cout << "chunked scan test: " << (pass ? "PASS" : "FAIL") << "\n";
+    return pass;
+}
+
+//! \brief check that the prefix published by an asynchronous scan is final while the scan is running
+bool test_async(std::size_t numElements, int numThreads)
+{
+    std::vector<uint64_t> in(numElements), out(numElements, 0), ref(numElements);
+    for (std::size_t i = 0; i < numElements; ++i)
+        in[i] = i % 5;
+    stl::exclusive_scan(in.begin(), in.end(), ref.begin(), uint64_t(11));
+
+    auto handle = scan::exclusiveScanAsync(in.data(), out.data(), numElements, std::max(numThreads / 2, 1), uint64_t(11));
+
+    handle.waitFor(numElements / 2);
+    std::size_t ready = handle.ready();
+    bool pass = (ready >= numElements / 2) && std::equal(out.begin(), out.begin() + ready, ref.begin());
+
+    uint64_t total = handle.get();
+    pass = pass && (out == ref) && handle.ready() == numElements && (numElements == 0 || total == ref.back() + in.back());
+
+    std::cout << "async scan test: " << (pass ? "PASS" : "FAIL") << "\n";
+    return pass;
+}
+
+//! \brief check that the reproducible floating-point scan is bitwise identical for different thread counts
+bool test_reproducible(std::size_t numElements, int numThreads)
+{
+    std::vector<double> in(numElements), ref(numElements), out(numElements);
+    for (std::size_t i = 0; i < numElements; ++i)
+        in[i] = std::sin(double(i)) * 1e3 + 1.0 / (i + 1);
+
+    scan::reproducibleExclusiveScan(in.data(), ref.data(), numElements, 0.5);
+
+    bool pass = true;
+    for (int t : {1, 2, 3, 2 * numThreads + 1})
+    {
+        omp_set_num_threads(t);
+        scan::reproducibleExclusiveScan(in.data(), out.data(), numElements, 0.5);
+        pass = pass && std::equal(out.begin(), out.end(), ref.begin(),
+                                  [](double a, double b) { return std::memcmp(&a, &b, sizeof(double)) == 0; });
+    }
+    omp_set_num_threads(numThreads);
+
+    // the result must not depend on the alignment of the output either
+    std::vector<double> shifted(numElements + 1);
+    scan::reproducibleExclusiveScan(in.data(), shifted.data() + 1, numElements, 0.5);
+    pass = pass && std::equal(ref.begin(), ref.end(), shifted.begin() + 1,
+                              [](double a, double b) { return std::memcmp(&a, &b, sizeof(double)) == 0; });
+
+    std::vector<double> inplace = in;
+    scan::reproducibleExclusiveScan(inplace.data(), inplace.data(), numElements, 0.5);
+    pass = pass && (inplace == ref);
+
+    long double sum = 0.5, maxError = 0;
+    for (std::size_t i = 0; i < numElements; ++i)
+    {
+        maxError = std::max(maxError, std::abs(ref[i] - sum));
+        sum += in[i];
+    }
+    pass = pass && maxError < 1e-6;
+
+    std::cout << "reproducible scan test: " << (pass ? "PASS" : "FAIL") << "\n";
+    return pass;
+}
+
+//! \brief check fused max, min, bitwise-or and argmax scans against std::inclusive_scan and std::exclusive_scan
+bool test_operators(std::size_t numElements)
+{
+    std::vector<unsigned> in(numElements), excl(numElements), incl(numElements), refExcl(numElements), refIncl(numElements);
+    for (std::size_t i = 0; i < numElements; ++i)
+        in[i] = unsigned((i * 2654435761u) % 1000003);
+
+    scan::Max<unsigned> maxOp;
+    unsigned total = scan::fusedScan(in.data(), excl.data(), incl.data(), numElements, maxOp);
+    std::exclusive_scan(in.begin(), in.end(), refExcl.begin(), 0u, maxOp);
+    std::inclusive_scan(in.begin(), in.end(), refIncl.begin(), maxOp, 0u);
+    bool pass = (excl == refExcl) && (incl == refIncl) && (numElements == 0 || total == refIncl.back());
+
+    for (std::size_t i = 0; i < numElements; ++i)
+        in[i] = 1u << (i % 29);
+    scan::inclusiveScanOp(in.data(), in.data(), numElements, 0u, scan::BitOr<unsigned>{});
+    for (std::size_t i = 0; i < numElements; ++i)
+        pass = pass && in[i] == ((i < 28) ? (1u << (i + 1)) - 1 : (1u << 29) - 1);
+
+    using ValueIndex = std::pair<double, std::size_t>;
+    std::vector<ValueIndex> values(numElements), argmax(numElements), refArgmax(numElements);
+    for (std::size_t i = 0; i < numElements; ++i)
+        values[i] = {std::sin(0.001 * i) * double(i % 1000), i};
+
+    scan::ArgMax<double, std::size_t> argmaxOp;
+    scan::fusedScan(values.data(), (ValueIndex*)nullptr, argmax.data(), numElements, argmaxOp);
+    std::inclusive_scan(values.begin(), values.end(), refArgmax.begin(), argmaxOp, argmaxOp.identity());
+    pass = pass && (argmax == refArgmax);
+
+    // floating-point identities are infinite, so that prefixes of infinite inputs stay exact
+    const double inf = std::numeric_limits<double>::infinity();
+    std::vector<double> fin(numElements, -inf), fexcl(numElements), fincl(numElements), fref(numElements);
+    for (std::size_t i = 999; i < numElements; i += 1000)
+        fin[i] = double(i % 7919);
+    scan::fusedScan(fin.data(), fexcl.data(), (double*)nullptr, numElements, scan::Max<double>{});
+    std::exclusive_scan(fin.begin(), fin.end(), fref.begin(), -inf, scan::Max<double>{});
+    pass = pass && (fexcl == fref);
+
+    for (double& x : fin)
+        x = -x;
+    scan::fusedScan(fin.data(), (double*)nullptr, fincl.data(), numElements, scan::Min<double>{});
+    std::inclusive_scan(fin.begin(), fin.end(), fref.begin(), scan::Min<double>{}, inf);
+    pass = pass && (fincl == fref) && scan::Min<double>::identity() == inf;
+
+    std::cout << "operator scan test: " << (pass ? "PASS" : "FAIL") << "\n";
+    return pass;
+}
+
+//! \brief check the multi-lane scans of AoS rows and SoA columns against a serial scan per lane
+bool test_multi(std::size_t numElements)
+{
+    constexpr int K = 4;
+
+    std::vector<uint64_t> rows(numElements * K), out(numElements * K), ref(numElements * K);
+    for (std::size_t i = 0; i < rows.size(); ++i)
+        rows[i] = i % (7 + i % K);
+
+    scan::Lanes<uint64_t, K> init{1, 2, 3, 4}, refTotal = init;
+    for (std::size_t i = 0; i < numElements; ++i)
+        for (int k = 0; k < K; ++k)
+        {
+            ref[i * K + k] = refTotal[k];
+            refTotal[k] += rows[i * K + k];
+        }
+
+    auto total = scan::exclusiveScanLanes<K>(rows.data(), out.data(), numElements, init);
+    bool pass  = (out == ref) && (total == refTotal);
+
+    std::vector<unsigned> columns[K], scanned[K];
+    const unsigned* in[K];
+    unsigned* outColumns[K];
+    for (int k = 0; k < K; ++k)
+    {
+        columns[k].resize(numElements);
+        scanned[k].resize(numElements);
+        for (std::size_t i = 0; i < numElements; ++i)
+            columns[k][i] = unsigned(rows[i * K + k]);
+        in[k]         = columns[k].data();
+        outColumns[k] = scanned[k].data();
+    }
+
+    auto columnTotal = scan::exclusiveScanColumns<K>(in, outColumns, numElements, scan::Lanes<unsigned, K>{1, 2, 3, 4});
+    for (int k = 0; k < K; ++k)
+    {
+        for (std::size_t i = 0; i < numElements; ++i)
+            pass = pass && scanned[k][i] == unsigned(ref[i * K + k]);
+        pass = pass && columnTotal[k] == unsigned(refTotal[k]);
+    }
+
+    std::cout << "multi-lane scan test (" << K << " lanes): " << (pass ? "PASS" : "FAIL") << "\n";
+    return pass;
+}
+
+//! \brief round-trip n values whose deltas are exactly \a bits wide in every block, bit-packed and as varints
+template<class T>
+bool packedRoundTrip(uint32_t bits, std::size_t n)
+{
+    T mask = (bits == 8 * sizeof(T)) ? ~T(0) : (T(1) << bits) - T(1);
+
+    // the first delta of each block sets the top bit, the values wrap around for the wide widths
+    std::vector<T> values(n), decoded(n);
+    T value = 0;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        value += (i % scan::packedBlockSize == 0) ? mask : T(i * 0x9E3779B97F4A7C15ull) & mask;
+        values[i] = value;
+    }
+
+    auto packed = scan::packDeltas(values.data(), n);
+    scan::deltaDecode(packed, decoded.data());
+    bool pass = (decoded == values);
+    for (const auto& block : packed.blocks)
+        pass = pass && block.bits == bits;
+
+    std::fill(decoded.begin(), decoded.end(), T(0));
+    scan::deltaDecode(scan::packDeltas(values.data(), n, true), decoded.data());
+    return pass && (decoded == values);
+}
+
+//! \brief round-trip sorted offsets through bit-packed and varint delta blocks, and check the compression
+bool test_packed(std::size_t numElements)
+{
+    std::vector<uint32_t> offsets(numElements), decoded(numElements);
+    for (std::size_t i = 1; i < numElements; ++i)
+        offsets[i] = offsets[i - 1] + uint32_t((i * 2654435761u) % 37);
+
+    auto packed = scan::packDeltas(offsets.data(), numElements);
+    scan::deltaDecode(packed, decoded.data());
+    bool pass = (decoded == offsets) && (numElements < 4096 || packed.bytes() * 4 < numElements * sizeof(uint32_t));
+
+    std::fill(decoded.begin(), decoded.end(), 0);
+    auto varints = scan::packDeltas(offsets.data(), numElements, true);
+    scan::deltaDecode(varints, decoded.data());
+    pass = pass && (decoded == offsets);
+
+    // every bit width, including 0 (constant runs) and the full word, at block boundary sizes
+    for (std::size_t n : {std::size_t(1023), std::size_t(1024), std::size_t(1025)})
+    {
+        for (uint32_t bits = 0; bits <= 32; ++bits)
+            pass = pass && packedRoundTrip<uint32_t>(bits, n);
+        for (uint32_t bits = 0; bits <= 64; ++bits)
+            pass = pass && packedRoundTrip<uint64_t>(bits, n);
+    }
+
+    std::cout << "packed delta scan test: " << (pass ? "PASS" : "FAIL") << "\n";
+    return pass;
+}
+
+//! \brief check scans of narrow counts into 64-bit offsets, with totals beyond 2^32 for large inputs
+template<class In>
+bool test_widening(std::size_t numElements)
+{
+    std::vector<In> in(numElements);
+    for (std::size_t i = 0; i < numElements; ++i)
+        in[i] = In(std::numeric_limits<In>::max() - i % 7);
+
+    std::vector<uint64_t> ref(numElements), out(numElements);
+    uint64_t sum = 0;
+    for (std::size_t i = 0; i < numElements; ++i)
+    {
+        ref[i] = sum;
+        sum += in[i];
+    }
+
+    bool pass = true;
+    auto check = [&](auto&& scanFunc)
+    {
+        std::fill(out.begin(), out.end(), uint64_t(0));
+        scanFunc();
+        pass = pass && (out == ref);
+    };
+    check([&]() { scan::exclusiveScan(in.data(), out.data(), numElements); });
+    check([&]() { v1::exclusiveScan<uint64_t, 4>(in.data(), out.data(), numElements); });
+    check([&]() { v2::exclusiveScan<uint64_t, 4>(in.data(), out.data(), numElements); });
+    check([&]() { v3::exclusiveScan(in.data(), out.data(), numElements); });
+    check([&]() { v3::reduceThenScan(in.data(), out.data(), numElements); });
+    check([&]() { v1::exclusiveScanStream<uint64_t, 4>(in.data(), out.data(), numElements); });
+
+    std::cout << "widening scan test (" << sizeof(In) << " -> 8 bytes): " << (pass ? "PASS" : "FAIL") << "\n";
+    return pass;
+}
+
+//! \brief check transform scans of run-start flags computed on the fly from a key array
+bool test_transform(std::size_t numElements)
+{
+    std::vector<unsigned> keys(numElements);
+    for (std::size_t i = 0; i < numElements; ++i)
+        keys[i] = unsigned(i / 3 + i / 7);
+
+    auto runStart = [&keys](std::size_t i) { return uint64_t(i == 0 || keys[i] != keys[i - 1]); };
+
+    std::vector<uint64_t> flags(numElements), ref(numElements), out(numElements);
+    for (std::size_t i = 0; i < numElements; ++i)
+        flags[i] = runStart(i);
+
+    std::vector<std::size_t> indices(numElements);
+    std::iota(indices.begin(), indices.end(), 0);
+
+    stl::exclusive_scan(flags.begin(), flags.end(), ref.begin(), uint64_t(3));
+    scan::transformExclusiveScan(indices.begin(), indices.end(), out.data(), uint64_t(3), runStart);
+    bool pass = (out == ref);
+
+    for (std::size_t i = 0; i < numElements; ++i)
+        ref[i] += flags[i];
+    scan::transformInclusiveScan(indices.cbegin(), indices.cend(), out.data(), runStart, uint64_t(3));
+    pass = pass && (out == ref);
+
+    std::cout << "transform scan test: " << (pass ? "PASS" : "FAIL") << "\n";
+    return pass;
+}
+
+//! \brief check copyIf, stablePartition and an 8-bit radix bucket scatter against the standard algorithms
+bool test_primitives(std::size_t numElements)
+{
+    std::vector<unsigned> in(numElements), out(numElements), ref;
+    for (std::size_t i = 0; i < numElements; ++i)
+        in[i] = unsigned(i * 2654435761u);
+
+    auto pred = [](unsigned x) { return x % 3 == 0; };
+    std::copy_if(in.begin(), in.end(), std::back_inserter(ref), pred);
+    std::size_t numCopied = scan::copyIf(in.data(), out.data(), numElements, pred);
+    bool pass = (numCopied == ref.size()) && std::equal(ref.begin(), ref.end(), out.begin());
+
+    ref = in;
+    auto middle = std::stable_partition(ref.begin(), ref.end(), pred);
+    std::size_t numTrue = scan::stablePartition(in.data(), out.data(), numElements, pred);
+    pass = pass && (numTrue == std::size_t(middle - ref.begin())) && (out == ref);
+
+    auto digit = [](unsigned x) { return (x >> 8) & 255; };
+    ref = in;
+    std::stable_sort(ref.begin(), ref.end(), [digit](unsigned a, unsigned b) { return digit(a) < digit(b); });
+    std::vector<std::size_t> bucketOffsets(257);
+    scan::bucketScatter<256>(in.data(), out.data(), numElements, digit, bucketOffsets.data());
+    pass = pass && (out == ref) && (bucketOffsets[256] == numElements);
+    for (int b = 0; b < 256 && pass; ++b)
+        pass = (bucketOffsets[b] == std::size_t(std::lower_bound(ref.begin(), ref.end(), b, [digit](unsigned x, int d) {
+                    return int(digit(x)) < d; }) - ref.begin()));
+
+    std::cout << "scan primitives test: " << (pass ? "PASS" : "FAIL") << "\n";
+    return pass;
+}
+
+//! \brief check the 2D scans against the serial recurrence, out of place and in place
+bool test_scan2d(std::size_t numElements)
+{
+    std::size_t cols = 1000 + 3 * 1024 + 5;
+    std::size_t rows = numElements / cols + 1;
+
+    std::vector<uint64_t> in(rows * cols), out(rows * cols), incl(rows * cols), excl(rows * cols);
+    for (std::size_t i = 0; i < in.size(); ++i)
+        in[i] = i % 5;
+
+    for (std::size_t r = 0; r < rows; ++r)
+    {
+        uint64_t rowSum = 0;
+        for (std::size_t c = 0; c < cols; ++c)
+        {
+            uint64_t above = r ? incl[(r - 1) * cols + c] : 0;
+            excl[r * cols + c] = (r && c) ? incl[(r - 1) * cols + c - 1] : 0;
+            rowSum += in[r * cols + c];
+            incl[r * cols + c] = above + rowSum;
+        }
+    }
+
+    scan::inclusiveScan2D(in.data(), out.data(), rows, cols);
+    bool pass = (out == incl);
+    scan::exclusiveScan2D(in.data(), out.data(), rows, cols);
+    pass = pass && (out == excl);
+    scan::inclusiveScan2D(in.data(), in.data(), rows, cols);
+    pass = pass && (in == incl);
+
+    std::cout << "2D scan test (" << rows << " x " << cols << "): " << (pass ? "PASS" : "FAIL") << "\n";
+    return pass;
+}
+
+//! \brief check the windowed file scan, with windows much smaller than the file
+bool test_file(std::size_t numElements)
+{
+    std::string inPath = "scan_test_in.bin", outPath = "scan_test_out.bin";
+
+    std::vector<uint64_t> in(numElements, 1), out(numElements), ref(numElements);
+    std::iota(in.begin(), in.end(), 0);
+    stl::exclusive_scan(in.begin(), in.end(), ref.begin(), uint64_t(0));
+
+    std::ofstream(inPath, std::ios::binary).write((const char*)in.data(), numElements * sizeof(uint64_t));
+
+    bool pass = scan::fileExclusiveScan<uint64_t>(inPath, outPath, 3 * 4096);
+    std::ifstream(outPath, std::ios::binary).read((char*)out.data(), numElements * sizeof(uint64_t));
+    pass = pass && (out == ref);
+
+    // same file as input and output, also under a different name, is scanned in place instead of truncated
+    std::string aliasPath = "./" + inPath;
+    std::fill(out.begin(), out.end(), 0);
+    pass = pass && scan::fileExclusiveScan<uint64_t>(inPath, aliasPath, 3 * 4096);
+    std::ifstream(inPath, std::ios::binary).read((char*)out.data(), numElements * sizeof(uint64_t));
+    pass = pass && (out == ref);
+
+    std::remove(inPath.c_str());
+    std::remove(outPath.c_str());
+
+    std::cout << "file scan test: " << (pass ? "PASS" : "FAIL") << "\n";
+    return pass;
+}
+
+//! \brief scan a file of raw T with timing
+template<class T>
+int scanFile(const std::string& inPath, const std::string& outPath, std::size_t windowBytes)
+{
+    auto tp0 = std::chrono::high_resolution_clock::now();
+    bool ok  = scan::fileExclusiveScan<T>(inPath, outPath, windowBytes);
+    auto tp1 = std::chrono::high_resolution_clock::now();
+
+    if (!ok)
+    {
+        std::cout << "could not scan " << inPath << " into " << outPath << "\n";
+        return 1;
+    }
+
+    double t = std::chrono::duration<double>(tp1 - tp0).count();
+    std::ifstream fin(inPath, std::ios::binary | std::ios::ate);
+    double bytes = fin.tellg();
+    std::cout << "scanned " << inPath << " in " << t << " s, " << 2 * bytes / t / 1e9 << " GB/s read+write\n";
+    return 0;
+}
+
+//! \brief print the per-thread phase profile of \a func, requires compiling with -DSCAN_PROFILE
+void profileScan(std::string name, const unsigned* input, unsigned* output, std::size_t numElements,
+                 void (*func)(const unsigned*, unsigned*, std::size_t))
+{
+    func(input, output, numElements);
+    scan::profile::reset();
+    for (int r = 0; r < 10; ++r)
+        func(input, output, numElements);
+
+    std::cout << name << " phase profile, 10 repetitions:\n";
+    scan::profile::report(std::cout);
+}
+
+//! \brief tune all size classes from 4 KiB up to \a maxElements
+template<class T>
+void tuneScan(std::size_t maxElements)
+{
+    scan::TuneCache& cache = scan::tuneCache();
+    for (std::size_t n = 4096 / sizeof(T); n <= maxElements; n *= 2)
+    {
+        auto best = scan::tune<T>(cache, n);
+        std::cout << scan::typeTag<T>() << " " << n << " elements: " << best.variant << " " << best.nPages << "\n";
+    }
+}
+
 int main(int argc, char** argv)
 {
     std::size_t numElements = 10000000;
+    if (argc > 1 && std::string(argv[1]) == "--tune")
+    {
+        if (argc > 2)
+            numElements = std::stoull(argv[2]);
+
+        const scan::Bandwidth& bw = scan::calibrateBandwidth();
+        std::cout << "SCAN_BANDWIDTH=" << bw.read / 1e9 << "," << bw.write / 1e9 << "," << bw.stream / 1e9 << "\n";
+
+        tuneScan<unsigned>(numElements);
+        tuneScan<uint64_t>(numElements);
+        tuneScan<double>(numElements);
+
+        std::string path = scan::TuneCache::defaultPath();
+        if (scan::tuneCache().save(path))
+            std::cout << "tuning written to " << path << "\n";
+        else
+            std::cout << "could not write " << path << "\n";
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--file")
+    {
+        if (argc < 5)
+        {
+            std::cout << "usage: " << argv[0] << " --file <u8|u16|u32|u64|i32|i64|f32|f64> <in> <out> [window MiB]\n";
+            return 1;
+        }
+        std::string type = argv[2];
+        std::size_t windowBytes = (argc > 5) ? std::stoull(argv[5]) << 20 : scan::fileWindowBytes;
+
+        if (type == "u8") return scanFile<uint8_t>(argv[3], argv[4], windowBytes);
+        if (type == "u16") return scanFile<uint16_t>(argv[3], argv[4], windowBytes);
+        if (type == "u32") return scanFile<uint32_t>(argv[3], argv[4], windowBytes);
+        if (type == "u64") return scanFile<uint64_t>(argv[3], argv[4], windowBytes);
+        if (type == "i32") return scanFile<int32_t>(argv[3], argv[4], windowBytes);
+        if (type == "i64") return scanFile<int64_t>(argv[3], argv[4], windowBytes);
+        if (type == "f32") return scanFile<float>(argv[3], argv[4], windowBytes);
+        if (type == "f64") return scanFile<double>(argv[3], argv[4], windowBytes);
+
+        std::cout << "unknown element type " << type << "\n";
+        return 1;
+    }
     if (argc > 1)
-        numElements = std::stoi(argv[1]);
+        numElements = std::stoull(argv[1]);
 
-    std::cout << "scanning " << numElements << " elements\n";
+    std::cout << "scanning " << numElements << " elements, simd kernels: " << simd::isaName(simd::isa()) << "\n";
 
     std::vector<unsigned> reference(numElements);
     std::iota(begin(reference), end(reference), 0);
 
-    unsigned* input  = (unsigned*)aligned_alloc(4096, numElements * sizeof(unsigned));
-    unsigned* output = (unsigned*)aligned_alloc(4096, numElements * sizeof(unsigned));
-
     int numThreads = 1;
     #pragma omp parallel
     {
@@ -88,16 +722,23 @@ int main(int argc, char** argv)
         numThreads = omp_get_num_threads();
     }
 
-    [[maybe_unused]] constexpr int n4kPagesPerThread_haswell  = 5;
-    [[maybe_unused]] constexpr int n4kPagesPerThread_epycrome = 32;
 
-    #pragma omp parallel for schedule(static, numElements/numThreads)           // favors v3
-    //#pragma omp parallel for schedule(static, n4kPagesPerThread_epycrome * 1024)  // favors v1<32>
-    for (size_t i = 0; i < numElements; ++i)
+    // place pages of input and output on the node of the thread that scans them
+    scan::Partition placement = v3::partition(numElements, numThreads);                                 // favors v3
+    //scan::Partition placement = v1::partition<unsigned, scan::blockPages>(numThreads);                // favors v1
+
+    unsigned* input  = scan::allocateFirstTouch(numElements, placement, 1u);
+    unsigned* output = scan::allocateFirstTouch(numElements, placement, 1u);
+    if (!input || !output)
     {
-        input[i]  = 1;
-        output[i] = 1;
+        std::cout << "could not allocate " << numElements << " elements\n";
+        free(input);
+        free(output);
+        return 1;
     }
+    std::cout << "buffer pages: "
+              << scan::allocationPageSize(numElements * sizeof(unsigned), placement.blockSize() * sizeof(unsigned)) / 1024
+              << " KiB, prefetch distance: " << simd::prefetchDistance() << " bytes\n";
 
     test_scan("serial", input, output, numElements, reference, exclusiveScanSerial<unsigned>);
     std::copy(input, input+numElements, output);
@@ -105,23 +746,97 @@ int main(int argc, char** argv)
     test_scan("serial inplace", input, output, numElements, reference, exclusiveScanSerialInplace<unsigned>);
     std::copy(input, input+numElements, output);
 
-    test_scan("parallel v1", input, output, numElements, reference, v1::exclusiveScan<unsigned, n4kPagesPerThread_epycrome>);
+    test_scan("parallel v1", input, output, numElements, reference, v1::exclusiveScan<unsigned, scan::blockPages>);
+    std::copy(input, input+numElements, output);
+
+    test_scan("parallel v1 inplace", input, output, numElements, reference, exclusiveScanParallelInplace<unsigned, scan::blockPages>);
     std::copy(input, input+numElements, output);
 
-    test_scan("parallel v1 inplace", input, output, numElements, reference, exclusiveScanParallelInplace<unsigned, n4kPagesPerThread_epycrome>);
+    test_scan("parallel v2", input, output, numElements, reference, v2::exclusiveScan<unsigned, scan::blockPages>);
     std::copy(input, input+numElements, output);
 
-    test_scan("parallel v2", input, output, numElements, reference, v2::exclusiveScan<unsigned, n4kPagesPerThread_epycrome>);
+    test_scan("parallel v2 inplace", input, output, numElements, reference, exclusiveScanV2Inplace<unsigned, scan::blockPages>);
     std::copy(input, input+numElements, output);
 
     test_scan("parallel v3", input, output, numElements, reference, v3::exclusiveScan<unsigned>);
+    std::copy(input, input+numElements, output);
+
+    test_scan("parallel v3 inplace", input, output, numElements, reference, exclusiveScanV3Inplace<unsigned>);
+    std::copy(input, input+numElements, output);
+
+    test_scan("parallel v3 orphaned", input, output, numElements, reference, exclusiveScanOrphaned<unsigned>);
+    std::copy(input, input+numElements, output);
+
+    test_scan("parallel v3 reduce-then-scan", input, output, numElements, reference, v3::reduceThenScan<unsigned>);
+    std::copy(input, input+numElements, output);
+
+    test_scan("parallel v3 reduce-then-scan inplace", input, output, numElements, reference, reduceThenScanInplace<unsigned>);
+    std::copy(input, input+numElements, output);
+
+    test_scan("parallel v3 adaptive", input, output, numElements, reference, v3::exclusiveScanAdaptive<unsigned>);
+    std::copy(input, input+numElements, output);
+
+    test_scan("parallel front end", input, output, numElements, reference, exclusiveScanFrontEnd<unsigned>);
+    std::copy(input, input+numElements, output);
+
+    test_edge_sizes(numThreads);
+    test_inplace_float(numElements);
+    test_segmented(numElements);
+    test_batched(numElements);
+    test_chunked(numElements);
+    test_transform(numElements);
+    test_primitives(numElements);
+    test_scan2d(numElements);
+    test_file(numElements);
+    test_async(numElements, numThreads);
+    test_reproducible(numElements, numThreads);
+    test_operators(numElements);
+    test_multi(numElements);
+    test_packed(numElements);
+    test_widening<uint8_t>(numElements);
+    test_widening<uint16_t>(numElements);
+    test_widening<uint32_t>(numElements);
+
+    test_scan("parallel tuned", input, output, numElements, reference, scan::tuned::exclusiveScan<unsigned>);
+    std::copy(input, input+numElements, output);
+
+    test_scan("parallel v4", input, output, numElements, reference, v4::exclusiveScan<unsigned, scan::blockPages>);
+    std::copy(input, input+numElements, output);
+
+    test_scan("parallel v1 streaming", input, output, numElements, reference, v1::exclusiveScanStream<unsigned, scan::blockPages>);
+    std::copy(input, input+numElements, output);
+
+    test_scan("parallel v4 streaming", input, output, numElements, reference, v4::exclusiveScanStream<unsigned, scan::blockPages>);
 
     benchmark_scan("serial", input, output, numElements, reference, exclusiveScanSerial<unsigned>);
     benchmark_scan("serial inplace", input, output, numElements, reference, exclusiveScanSerialInplace<unsigned>);
-    benchmark_scan("parallel v1", input, output, numElements, reference, v1::exclusiveScan<unsigned, n4kPagesPerThread_epycrome>);
-    benchmark_scan("parallel v1 inplace", input, output, numElements, reference, exclusiveScanParallelInplace<unsigned, n4kPagesPerThread_epycrome>);
-    benchmark_scan("parallel v2", input, output, numElements, reference, v2::exclusiveScan<unsigned, n4kPagesPerThread_epycrome>);
+    double bwV1 = benchmark_scan("parallel v1", input, output, numElements, reference, v1::exclusiveScan<unsigned, scan::blockPages>);
+    benchmark_scan("parallel v1 inplace", input, output, numElements, reference, exclusiveScanParallelInplace<unsigned, scan::blockPages>);
+    benchmark_scan("parallel v2", input, output, numElements, reference, v2::exclusiveScan<unsigned, scan::blockPages>);
+    benchmark_scan("parallel v2 inplace", input, output, numElements, reference, exclusiveScanV2Inplace<unsigned, scan::blockPages>);
     benchmark_scan("parallel v3", input, output, numElements, reference, v3::exclusiveScan<unsigned>);
+    benchmark_scan("parallel v3 inplace", input, output, numElements, reference, exclusiveScanV3Inplace<unsigned>);
+    benchmark_scan("parallel v3 orphaned", input, output, numElements, reference, exclusiveScanOrphaned<unsigned>);
+    benchmark_scan("parallel v3 reduce-then-scan", input, output, numElements, reference, v3::reduceThenScan<unsigned>);
+    benchmark_scan("parallel v3 adaptive", input, output, numElements, reference, v3::exclusiveScanAdaptive<unsigned>);
+    benchmark_scan("parallel front end", input, output, numElements, reference, exclusiveScanFrontEnd<unsigned>);
+    benchmark_scan("parallel tuned", input, output, numElements, reference, scan::tuned::exclusiveScan<unsigned>);
+    double bwV4 = benchmark_scan("parallel v4", input, output, numElements, reference, v4::exclusiveScan<unsigned, scan::blockPages>);
+
+    double bwV1Stream = benchmark_scan("parallel v1 streaming", input, output, numElements, reference,
+                                       v1::exclusiveScanStream<unsigned, scan::blockPages>);
+    double bwV4Stream = benchmark_scan("parallel v4 streaming", input, output, numElements, reference,
+                                       v4::exclusiveScanStream<unsigned, scan::blockPages>);
+    std::cout << "streaming store speedup v1: " << bwV1Stream / bwV1 << ", v4: " << bwV4Stream / bwV4
+              << " (used automatically above " << simd::llcSize() << " bytes)\n";
+
+    if (scan::profile::enabled)
+    {
+        profileScan("parallel v1", input, output, numElements, v1::exclusiveScan<unsigned, scan::blockPages>);
+        profileScan("parallel v2", input, output, numElements, v2::exclusiveScan<unsigned, scan::blockPages>);
+        profileScan("parallel v3", input, output, numElements, v3::exclusiveScan<unsigned>);
+        profileScan("parallel v3 reduce-then-scan", input, output, numElements, v3::reduceThenScan<unsigned>);
+    }
 
     free(input);
     free(output);
@@ -0,0 +1,129 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Parallel prefix sum front end
+ *
+ * scan::exclusiveScan picks the number of threads and the variant from the size of the input:
+ * small inputs are scanned serially, medium ones with as many threads as have at least
+ * minBytesPerThread to work on, using v3 while input and output fit into the last-level
+ * cache and v1 (with streaming stores) beyond. In-place scans use the interleaved prescan and
+ * shift pipeline of v2, which needs no second buffer. If the tuning file (see scan_tune.hpp)
+ * has an entry for the element type and thread count, the tuned variant and block size of the
+ * nearest size class are used instead; the file is read on the first parallel scan.
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+
+#include <omp.h>
+
+#include "scan_context.hpp"
+#include "scan_simd.hpp"
+#include "scan_tune.hpp"
+#include "scan_v1.hpp"
+#include "scan_v2.hpp"
+#include "scan_v3.hpp"
+
+namespace scan
+{
+
+//! \brief inputs up to this size are scanned serially
+constexpr size_t serialBytes = 64 * 1024;
+//! \brief minimum amount of input per thread that pays for the synchronization
+constexpr size_t minBytesPerThread = 32 * 1024;
+//! \brief block size of v1 and v2 in 4k pages, unless tuned for the size class and thread count
+constexpr int blockPages = 16;
+
+//! \brief number of threads to use for a scan of \a bytes
+inline int scanThreads(size_t bytes, int maxThreads)
+{
+    if (bytes <= serialBytes) { return 1; }
+    return int(std::clamp(bytes / minBytesPerThread, size_t(1), size_t(maxThreads)));
+}
+
+//! \brief context of the calling thread, large enough for omp_get_max_threads()
+template<class T>
+ScanContext<T>& threadContext()
+{
+    thread_local std::unique_ptr<ScanContext<T>> ctx;
+
+    int maxThreads = omp_get_max_threads();
+    if (!ctx || ctx->numThreads() < maxThreads) { ctx = std::make_unique<ScanContext<T>>(maxThreads); }
+    return *ctx;
+}
+
+/*! \brief exclusive scan of in[0:numElements] into out, seeded with \a init
+ *
+ * The input type In may be narrower than the output type T, e.g. uint8_t counts and uint64_t
+ * offsets; the input is then widened in registers and read with sizeof(In) bytes per element.
+ * \a in and \a out may be identical (in-place scan), but must not overlap otherwise.
+ */
+template<class In, class T>
+void exclusiveScan(const In* in, T* out, size_t numElements, T init = T(0))
+{
+    if (numElements == 0) { return; }
+
+    size_t bytes   = numElements * sizeof(T);
+    int numThreads = scanThreads(bytes, omp_get_max_threads());
+    if (numThreads == 1)
+    {
+        simd::exclusiveScan(in, out, numElements, init);
+        return;
+    }
+
+    ScanContext<T>& ctx = threadContext<T>();
+
+    bool inPlace = false;
+    if constexpr (std::is_same_v<In, T>) { inPlace = (in == out); }
+    bool inCache = numElements * (sizeof(In) + sizeof(T)) <= simd::llcSize();
+
+    // a choice of the tuner for this size class and thread count overrides the static one
+    if constexpr (std::is_same_v<In, T>)
+    {
+        if (const ScanCandidate<T>* tuned = tuned::find<T>(numElements, numThreads))
+        {
+            #pragma omp parallel num_threads(numThreads)
+            {
+                if (inPlace) { tuned->inplaceTeam(ctx, out, numElements, init); }
+                else { tuned->team(ctx, in, out, numElements, init); }
+            }
+            return;
+        }
+    }
+
+    #pragma omp parallel num_threads(numThreads)
+    {
+        if (inPlace) { v2::exclusiveScanTeam<T, blockPages>(ctx, out, numElements, init); }
+        else if (inCache) { v3::exclusiveScanTeam(ctx, in, out, numElements, init); }
+        else { v1::exclusiveScanTeam<T, blockPages>(ctx, in, out, numElements, init); }
+    }
+}
+
+} // namespace scan
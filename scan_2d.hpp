@@ -0,0 +1,144 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Parallel 2D scan (summed-area table) of a row-major grid
+ *
+ * Each thread owns a contiguous band of rows. The carry into a band is a vector: the column
+ * sums of all rows above it. In a first pass each thread sums the columns of its band; after
+ * the barrier the sums of the preceding bands, scanned along the row, seed the band. The band
+ * is then swept in column tiles of 8 KiB: each row tile is scanned along the row into an L1
+ * buffer, continuing from the row's carry of the previous tile, and added across columns to a
+ * tile accumulator holding the running sum of the rows above, which is written to the output.
+ * The input is read twice and the output written once, all accesses are unit stride within a
+ * tile and the column direction is vectorized across columns.
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <omp.h>
+
+#include "scan.hpp"
+#include "scan_partition.hpp"
+#include "scan_simd.hpp"
+
+namespace scan
+{
+
+/*! \brief 2D scan of the rows x cols grid \a in into \a out by all threads of the calling team
+ *
+ * \a colSums is shared by the team and has space for cols elements per thread. Does not synchronize on exit.
+ */
+template<bool Inclusive, class T>
+void scan2DTeam(const T* in, T* out, size_t rows, size_t cols, T* colSums)
+{
+    constexpr size_t tileSize = 8192 / sizeof(T);
+
+    int numThreads = omp_get_num_threads();
+    int tid        = omp_get_thread_num();
+
+    Partition part  = Partition::contiguous(rows, numThreads);
+    size_t rowBegin = part.blockOffset(0, tid);
+    size_t rowEnd   = (tid == numThreads - 1) ? rows : rowBegin + part.blockSize();
+
+    T* bandSums = colSums + tid * cols;
+    std::fill(bandSums, bandSums + cols, T(0));
+    for (size_t r = rowBegin; r < rowEnd; ++r)
+        simd::addTo(bandSums, in + r * cols, cols);
+
+    #pragma omp barrier
+
+    // sum of all rows above the band, scanned along the row
+    std::vector<T> acc(cols, T(0));
+    for (int t = 0; t < tid; ++t)
+        simd::addTo(acc.data(), colSums + t * cols, cols);
+
+    if constexpr (Inclusive) { simd::inclusiveScan(acc.data(), acc.data(), cols, T(0)); }
+    else { simd::exclusiveScan(acc.data(), acc.data(), cols, T(0)); }
+
+    std::vector<T> rowCarry(rowEnd - rowBegin, T(0));
+    T tile[tileSize];
+
+    for (size_t c = 0; c < cols; c += tileSize)
+    {
+        size_t width = std::min(tileSize, cols - c);
+        T* accTile   = acc.data() + c;
+
+        for (size_t r = rowBegin; r < rowEnd; ++r)
+        {
+            T& carry   = rowCarry[r - rowBegin];
+            T* outTile = out + r * cols + c;
+
+            if constexpr (Inclusive)
+            {
+                carry = simd::inclusiveScan(in + r * cols + c, tile, width, carry);
+                simd::addTo(accTile, tile, width);
+                std::memcpy(outTile, accTile, width * sizeof(T));
+            }
+            else
+            {
+                carry = simd::exclusiveScan(in + r * cols + c, tile, width, carry);
+                std::memcpy(outTile, accTile, width * sizeof(T));
+                simd::addTo(accTile, tile, width);
+            }
+        }
+    }
+}
+
+template<bool Inclusive, class T>
+void scan2D(const T* in, T* out, size_t rows, size_t cols)
+{
+    size_t bytes   = rows * cols * sizeof(T);
+    int numThreads = std::min(scanThreads(bytes, omp_get_max_threads()), int(std::max(rows, size_t(1))));
+
+    std::vector<T> colSums(size_t(numThreads) * cols);
+
+    #pragma omp parallel num_threads(numThreads)
+    scan2DTeam<Inclusive>(in, out, rows, cols, colSums.data());
+}
+
+/*! \brief summed-area table: out(i, j) = sum of in(0:i+1, 0:j+1) for the row-major rows x cols grid
+ *
+ * \a in and \a out may be identical.
+ */
+template<class T>
+void inclusiveScan2D(const T* in, T* out, size_t rows, size_t cols)
+{
+    scan2D<true>(in, out, rows, cols);
+}
+
+//! \brief out(i, j) = sum of in(0:i, 0:j), zero in the first row and column
+template<class T>
+void exclusiveScan2D(const T* in, T* out, size_t rows, size_t cols)
+{
+    scan2D<false>(in, out, rows, cols);
+}
+
+} // namespace scan
@@ -0,0 +1,259 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Non-blocking exclusive scan with readable partial results
+ *
+ * exclusiveScanAsync returns immediately with an AsyncScan handle. The scan runs on a separate
+ * team of the requested number of OpenMP threads, opened from a background thread, so the
+ * caller is free to run its own parallel regions with the remaining cores in the meantime.
+ *
+ * The team uses the block-cyclic decomposition of v1. After the shift of its block in step s a
+ * thread publishes s + 1 as its progress; all steps up to the minimum over the team are final,
+ * which makes the output readable in increments of one step (numThreads blocks) from the
+ * front while the tail is still being scanned. Consumers of the leading elements wait for
+ * the scan of one step, not of the whole array. Stores are regular, not streaming, so that
+ * published blocks are visible to the readers without a fence.
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+
+#include <omp.h>
+
+#include "scan.hpp"
+#include "scan_context.hpp"
+#include "scan_partition.hpp"
+#include "scan_simd.hpp"
+#include "scan_v1.hpp"
+
+namespace scan
+{
+
+//! \brief progress of an asynchronous scan, shared between the handle and the scanning team
+template<class T>
+class AsyncScanState
+{
+    struct alignas(64) Progress
+    {
+        std::atomic<size_t> steps{0};
+    };
+
+public:
+    AsyncScanState(size_t numElements, int numThreads)
+        : ctx(numThreads)
+        , numElements_(numElements)
+        , progress_(new Progress[numThreads])
+    {
+    }
+
+    //! \brief number of leading output elements that hold their final value
+    size_t ready() const
+    {
+        if (finished_.load(std::memory_order_acquire)) { return numElements_; }
+
+        int teamSize = teamSize_.load(std::memory_order_acquire);
+        if (teamSize == 0) { return 0; }
+
+        size_t steps = progress_[0].steps.load(std::memory_order_acquire);
+        for (int t = 1; t < teamSize; ++t)
+            steps = std::min(steps, progress_[t].steps.load(std::memory_order_acquire));
+
+        return steps * v1::partition<T, blockPages>(teamSize).elementsPerStep();
+    }
+
+    //! \brief block until ready() >= numElements
+    void waitFor(size_t numElements)
+    {
+        if (ready() >= numElements) { return; }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        ++waiters_;
+        cv_.wait(lock, [this, numElements]() { return ready() >= numElements; });
+        --waiters_;
+    }
+
+    void start(int teamSize) { teamSize_.store(teamSize, std::memory_order_release); }
+
+    //! \brief called by thread \a tid after its block of step \a step is final
+    void publish(int tid, size_t step)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        progress_[tid].steps.store(step + 1, std::memory_order_release);
+        notify(lock);
+    }
+
+    void finish()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        finished_.store(true, std::memory_order_release);
+        notify(lock);
+    }
+
+    ScanContext<T> ctx;
+
+private:
+    /*! \brief wake the waiters, if any, after an update made while holding \a lock
+     *
+     * A waiter evaluates its predicate and starts to wait with mutex_ held, so it either sees the
+     * update or is counted in waiters_ and woken.
+     */
+    void notify(std::unique_lock<std::mutex>& lock)
+    {
+        bool wake = waiters_ > 0;
+        lock.unlock();
+        if (wake) { cv_.notify_all(); }
+    }
+
+    size_t numElements_;
+    std::unique_ptr<Progress[]> progress_;
+    std::atomic<int> teamSize_{0};
+    std::atomic<bool> finished_{false};
+    int waiters_ = 0; // guarded by mutex_
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+
+/*! \brief exclusive scan of in[0:numElements] by all threads of the calling team, publishing completed steps
+ *
+ * \return init + the sum of the input on the last thread of the team, unspecified on the others
+ */
+template<class In, class T>
+T asyncScanTeam(AsyncScanState<T>& state, const In* in, T* out, size_t numElements, T init)
+{
+    ScanContext<T>& ctx = state.ctx;
+
+    int numThreads = ctx.teamSize();
+    int tid        = omp_get_thread_num();
+
+    Partition part   = v1::partition<T, blockPages>(numThreads);
+    size_t blockSize = part.blockSize();
+    size_t nSteps    = part.numSteps(numElements);
+
+    if (tid == 0) { state.start(numThreads); }
+    if (tid == numThreads - 1) { ctx.carry(1, numThreads) = init; }
+
+    T stepSum = init;
+    for (size_t step = 0; step < nSteps; ++step)
+    {
+        size_t stepOffset = part.blockOffset(step, tid);
+
+        ctx.carry(step%2, tid) = simd::exclusiveScan(in + stepOffset, out + stepOffset, blockSize, T(0));
+
+        #pragma omp barrier
+
+        T tSum = ctx.carry((step+1)%2, numThreads);
+        for (int t = 0; t < tid; ++t)
+            tSum += ctx.carry(step%2, t);
+
+        if (tid == numThreads - 1)
+        {
+            stepSum = tSum + ctx.carry(step%2, numThreads - 1);
+            ctx.carry(step%2, numThreads) = stepSum;
+        }
+
+        simd::addShift(out + stepOffset, blockSize, tSum);
+        state.publish(tid, step);
+    }
+
+    // remainder
+    if (tid == numThreads - 1)
+    {
+        size_t remOffset = part.remainderOffset(numElements);
+        stepSum          = simd::exclusiveScan(in + remOffset, out + remOffset, numElements - remOffset, stepSum);
+    }
+    return stepSum;
+}
+
+/*! \brief handle of a scan running in the background
+ *
+ * Destroying or reassigning the handle waits for the scan to complete.
+ */
+template<class T>
+class AsyncScan
+{
+public:
+    AsyncScan() = default;
+
+    template<class In>
+    AsyncScan(const In* in, T* out, size_t numElements, int numThreads, T init)
+        : state_(std::make_shared<AsyncScanState<T>>(numElements, numThreads))
+    {
+        auto state = state_;
+        total_     = std::async(std::launch::async,
+                                [state, in, out, numElements, numThreads, init]()
+                                {
+                                    T total = init;
+                                    #pragma omp parallel num_threads(numThreads)
+                                    {
+                                        T sum = asyncScanTeam(*state, in, out, numElements, init);
+                                        if (omp_get_thread_num() == omp_get_num_threads() - 1) { total = sum; }
+                                    }
+                                    state->finish();
+                                    return total;
+                                });
+    }
+
+    //! \brief number of leading elements of the output that are final and may be read, non-blocking
+    size_t ready() const { return state_->ready(); }
+
+    //! \brief block until at least out[0:numElements] is final
+    void waitFor(size_t numElements) const { state_->waitFor(numElements); }
+
+    //! \brief true if the whole output is final
+    bool done() const { return total_.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+
+    void wait() const { total_.wait(); }
+
+    //! \brief wait for completion and return init + the sum of the input, may be called once
+    T get() { return total_.get(); }
+
+private:
+    std::shared_ptr<AsyncScanState<T>> state_;
+    std::future<T> total_;
+};
+
+/*! \brief start an exclusive scan of in[0:numElements] into out on \a numThreads threads and return immediately
+ *
+ * The scan runs on its own team, in addition to any team of the calling thread; size the teams
+ * of concurrent work such that both together do not oversubscribe the cores. out[0:h.ready()]
+ * may be read while the scan is running, \a in must stay valid and unmodified and the rest of
+ * \a out must not be accessed until the scan is done. \a in and \a out must not overlap.
+ */
+template<class In, class T>
+AsyncScan<T> exclusiveScanAsync(const In* in, T* out, size_t numElements, int numThreads, T init = T(0))
+{
+    return AsyncScan<T>(in, out, numElements, std::max(numThreads, 1), init);
+}
+
+} // namespace scan
@@ -0,0 +1,201 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Measured memory bandwidth and a traffic model for choosing between scan variants
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+#include <omp.h>
+
+#include "scan_simd.hpp"
+
+namespace scan
+{
+
+//! \brief memory bandwidth in bytes/s of all threads together
+struct Bandwidth
+{
+    double read;
+    double write;
+    //! \brief write bandwidth with non-temporal stores
+    double stream;
+};
+
+/*! \brief measure read, write and streaming write bandwidth on a buffer of \a bytes
+ *
+ * Each thread works on its own first-touched chunk, the best of \a repetitions is returned.
+ */
+inline Bandwidth measureBandwidth(size_t bytes, int repetitions = 3)
+{
+    using Word    = uint64_t;
+    size_t nWords = bytes / sizeof(Word);
+
+    std::unique_ptr<Word[]> a(new Word[nWords]);
+    std::unique_ptr<Word[]> b(new Word[nWords]);
+
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < nWords; ++i)
+    {
+        a[i] = 1;
+        b[i] = 0;
+    }
+
+    auto bestOf = [repetitions](auto&& kernel)
+    {
+        double best = 0;
+        for (int r = 0; r < repetitions; ++r)
+        {
+            auto tp0 = std::chrono::high_resolution_clock::now();
+            kernel();
+            auto tp1 = std::chrono::high_resolution_clock::now();
+
+            double t = std::chrono::duration<double>(tp1 - tp0).count();
+            if (r == 0 || t < best) { best = t; }
+        }
+        return best;
+    };
+
+    Word sink = 0;
+    double tRead = bestOf([&]()
+    {
+        #pragma omp parallel reduction(+ : sink)
+        {
+            int nt = omp_get_num_threads(), tid = omp_get_thread_num();
+            size_t chunk = nWords / nt;
+            sink += simd::reduce(a.get() + tid * chunk, chunk);
+        }
+    });
+
+    double tWrite = bestOf([&]()
+    {
+        #pragma omp parallel
+        {
+            int nt = omp_get_num_threads(), tid = omp_get_thread_num();
+            size_t chunk = nWords / nt;
+            std::fill(b.get() + tid * chunk, b.get() + (tid + 1) * chunk, Word(tid));
+        }
+    });
+
+    // the scan kernel reads a as well, subtract the read time from the streaming write time
+    double tStream = bestOf([&]()
+    {
+        #pragma omp parallel
+        {
+            int nt = omp_get_num_threads(), tid = omp_get_thread_num();
+            size_t chunk = nWords / nt;
+            simd::exclusiveScanStream(a.get() + tid * chunk, b.get() + tid * chunk, chunk, Word(0));
+            simd::streamFence();
+        }
+    });
+
+    // keep the read loop from being optimized away
+    asm volatile("" : : "r"(sink));
+
+    double nBytes = nWords * sizeof(Word);
+    return {nBytes / tRead, nBytes / tWrite, nBytes / std::max(tStream - tRead, 0.1 * tStream)};
+}
+
+/*! \brief bandwidth model used until a measurement is made
+ *
+ * Only the ratios enter the choice of variant: regular stores cost a read for the write-allocate
+ * in addition to the write, non-temporal stores do not.
+ */
+inline Bandwidth staticBandwidth() { return {10e9, 5e9, 10e9}; }
+
+namespace detail
+{
+
+//! \brief SCAN_BANDWIDTH="read,write,stream" in GB/s if set, staticBandwidth() otherwise
+inline Bandwidth& bandwidthSetting()
+{
+    static Bandwidth bandwidth = []()
+    {
+        Bandwidth bw;
+        const char* env = std::getenv("SCAN_BANDWIDTH");
+        if (env && std::sscanf(env, "%lf,%lf,%lf", &bw.read, &bw.write, &bw.stream) == 3)
+        {
+            bw.read *= 1e9;
+            bw.write *= 1e9;
+            bw.stream *= 1e9;
+            return bw;
+        }
+        return staticBandwidth();
+    }();
+    return bandwidth;
+}
+
+} // namespace detail
+
+/*! \brief process-wide bandwidth for the choice between variants
+ *
+ * Never measures on its own: the value comes from SCAN_BANDWIDTH, from the last call to
+ * calibrateBandwidth(), or from staticBandwidth().
+ */
+inline const Bandwidth& memoryBandwidth() { return detail::bandwidthSetting(); }
+
+/*! \brief measure the bandwidth of this machine and use it for all later variant choices
+ *
+ * Streams two buffers of twice the last-level cache, at least 64 MiB each, with a full thread
+ * team, so it belongs in setup or tuning code. Must not be called while a scan is running.
+ */
+inline const Bandwidth& calibrateBandwidth()
+{
+    detail::bandwidthSetting() = measureBandwidth(std::max(2 * simd::llcSize(), size_t(64) << 20));
+    return detail::bandwidthSetting();
+}
+
+/*! \brief predicted memory time of scanning \a bytes with a shift pass over the output (v3)
+ *
+ * The first pass reads the input and writes the output, the shift pass reads and writes the
+ * output again, which costs memory traffic only if the output does not stay in cache.
+ */
+inline double shiftScanTime(size_t bytes, const Bandwidth& bw, size_t cacheBytes)
+{
+    double t = bytes / bw.read + bytes / bw.write;
+    if (2 * bytes > cacheBytes) { t += bytes / bw.read + bytes / bw.write; }
+    return t;
+}
+
+/*! \brief predicted memory time of scanning \a bytes with reduce-then-scan
+ *
+ * The input is read twice, the second time from cache if it fits, the output written once.
+ */
+inline double reduceThenScanTime(size_t bytes, const Bandwidth& bw, size_t cacheBytes, bool streaming)
+{
+    double t = bytes / bw.read + bytes / (streaming ? bw.stream : bw.write);
+    if (bytes > cacheBytes) { t += bytes / bw.read; }
+    return t;
+}
+
+} // namespace scan
@@ -0,0 +1,135 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Exclusive scan of data that arrives in chunks
+ *
+ * ChunkedScanner scans successive chunks of one logical sequence, carrying the running total
+ * from each chunk into the next. pipelinedExclusiveScan drives a scanner with three rotating
+ * buffers: while the OpenMP team scans chunk k in place, chunk k+1 is filled and chunk k-1 is
+ * drained on two additional threads. Peak memory is three chunks, independent of the length
+ * of the sequence.
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <future>
+#include <memory>
+
+#include "scan.hpp"
+
+namespace scan
+{
+
+template<class T>
+class ChunkedScanner
+{
+public:
+    //! \brief scanner for a sequence whose exclusive scan starts at \a init
+    explicit ChunkedScanner(T init = T(0))
+        : carry_(init)
+    {
+    }
+
+    /*! \brief scan the next chunk in[0:numElements] into out, seeded with the total of all previous chunks
+     *
+     * \a in and \a out may be identical, In may be narrower than T.
+     */
+    template<class In>
+    void scanChunk(const In* in, T* out, size_t numElements)
+    {
+        if (numElements == 0) { return; }
+
+        // in[numElements-1] is overwritten by an in-place scan
+        T last = in[numElements - 1];
+        exclusiveScan(in, out, numElements, carry_);
+        carry_ = out[numElements - 1] + last;
+    }
+
+    //! \brief init plus the sum of all elements scanned so far, i.e. the carry into the next chunk
+    T carry() const { return carry_; }
+
+    void reset(T init = T(0)) { carry_ = init; }
+
+private:
+    T carry_;
+};
+
+/*! \brief exclusive scan of a sequence produced and consumed in chunks of up to \a chunkSize elements
+ *
+ * \param fill   size_t fill(T* buffer, size_t capacity), writes the next elements of the sequence
+ *               into buffer and returns their number, 0 at the end of the sequence
+ * \param drain  void drain(const T* buffer, size_t n), receives the next n scanned elements
+ * \return       init plus the sum of the sequence
+ *
+ * fill and drain are each called by one thread at a time and in sequence order, but possibly
+ * not by the calling thread, and run concurrently with each other and with the scan.
+ */
+template<class T, class Fill, class Drain>
+T pipelinedExclusiveScan(Fill&& fill, Drain&& drain, size_t chunkSize, T init = T(0))
+{
+    constexpr int numBuffers = 3;
+
+    std::unique_ptr<T[]> buffers[numBuffers];
+    for (auto& buffer : buffers)
+    {
+        buffer.reset(new T[chunkSize]);
+    }
+    size_t counts[numBuffers] = {0, 0, 0};
+
+    ChunkedScanner<T> scanner(init);
+
+    size_t k  = 0;
+    counts[0] = fill(buffers[0].get(), chunkSize);
+    for (; counts[k % numBuffers] > 0; ++k)
+    {
+        T* current = buffers[k % numBuffers].get();
+        T* next    = buffers[(k + 1) % numBuffers].get();
+        T* prev    = buffers[(k + 2) % numBuffers].get();
+
+        auto filling = std::async(std::launch::async, [&fill, next, chunkSize]() { return fill(next, chunkSize); });
+
+        std::future<void> draining;
+        size_t prevCount = k > 0 ? counts[(k + 2) % numBuffers] : 0;
+        if (prevCount)
+        {
+            draining = std::async(std::launch::async, [&drain, prev, prevCount]() { drain(prev, prevCount); });
+        }
+
+        scanner.scanChunk(current, current, counts[k % numBuffers]);
+
+        counts[(k + 1) % numBuffers] = filling.get();
+        if (draining.valid()) { draining.get(); }
+    }
+
+    // the last chunk is drained after the loop
+    size_t lastCount = k > 0 ? counts[(k + 2) % numBuffers] : 0;
+    if (lastCount) { drain(buffers[(k + 2) % numBuffers].get(), lastCount); }
+
+    return scanner.carry();
+}
+
+} // namespace scan
@@ -0,0 +1,104 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Reusable per-thread carry storage for the parallel scans
+ *
+ * A ScanContext is created once and passed to every scan call. It holds the double-buffered
+ * superBlock carries, one cache line per thread, plus the thread count of the team that
+ * executes the scans. Scans called with a context from inside a parallel region run on the
+ * enclosing team (orphaned mode) without opening a new region; all threads of the team must
+ * make the call.
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <cassert>
+#include <memory>
+
+#include <omp.h>
+
+namespace scan
+{
+
+template<class T>
+class ScanContext
+{
+    struct alignas(64) CacheLine
+    {
+        T value;
+    };
+
+public:
+    //! \brief create storage for teams of up to \a numThreads threads
+    explicit ScanContext(int numThreads = omp_get_max_threads())
+        : numThreads_(numThreads)
+        , carries_(new CacheLine[2 * (numThreads + 1)])
+    {
+    }
+
+    ScanContext(const ScanContext&) = delete;
+    ScanContext& operator=(const ScanContext&) = delete;
+
+    int numThreads() const { return numThreads_; }
+
+    //! \brief carry of thread \a tid in buffer \a b, tid == numThreads is the running total
+    T& carry(int b, int tid) { return carries_[b * (numThreads_ + 1) + tid].value; }
+
+    //! \brief return the size of the calling team, which must fit into the context
+    int teamSize() const
+    {
+        int teamThreads = omp_get_num_threads();
+        assert(teamThreads <= numThreads_);
+        return teamThreads;
+    }
+
+private:
+    int numThreads_;
+    std::unique_ptr<CacheLine[]> carries_;
+};
+
+/*! \brief execute f() on all threads of a team
+ *
+ * If called from inside a parallel region, f() runs on the enclosing team followed by a
+ * barrier to make the result visible. Otherwise a new team of ctx.numThreads() is created.
+ */
+template<class T, class F>
+void teamInvoke(ScanContext<T>& ctx, F&& f)
+{
+    if (omp_in_parallel())
+    {
+        f();
+        #pragma omp barrier
+    }
+    else
+    {
+        #pragma omp parallel num_threads(ctx.numThreads())
+        f();
+    }
+}
+
+} // namespace scan
@@ -0,0 +1,223 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Out-of-core exclusive scan of binary files
+ *
+ * The input file is a raw array of T. Input and output are mapped one window at a time, the
+ * input with sequential-access hints. While a window is scanned in parallel, seeded with the
+ * carry of the previous windows, the next input window is already mapped and its read-ahead
+ * requested with MADV_WILLNEED. Only two input windows and one output window are mapped at a
+ * time, such that files larger than the main memory can be scanned. If both paths name the same
+ * file, it is scanned in place through read-write windows, again with the next one mapped ahead.
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "scan_chunked.hpp"
+
+namespace scan
+{
+
+//! \brief default size of the mapped windows
+constexpr size_t fileWindowBytes = size_t(256) << 20;
+
+//! \brief file mapping of bytes [offset, offset + bytes), unmapped on destruction
+class MappedWindow
+{
+public:
+    MappedWindow() = default;
+
+    MappedWindow(int fd, size_t offset, size_t bytes, int prot)
+        : bytes_(bytes)
+    {
+        data_ = mmap(nullptr, bytes, prot, MAP_SHARED, fd, offset);
+        if (data_ == MAP_FAILED) { data_ = nullptr; }
+    }
+
+    MappedWindow(MappedWindow&& other) noexcept { swap(other); }
+    MappedWindow& operator=(MappedWindow&& other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~MappedWindow()
+    {
+        if (data_) { munmap(data_, bytes_); }
+    }
+
+    void advise(int advice)
+    {
+        if (data_) { madvise(data_, bytes_, advice); }
+    }
+
+    template<class T>
+    T* data() const
+    {
+        return static_cast<T*>(data_);
+    }
+
+    size_t bytes() const { return bytes_; }
+
+    explicit operator bool() const { return data_ != nullptr; }
+
+private:
+    void swap(MappedWindow& other)
+    {
+        std::swap(data_, other.data_);
+        std::swap(bytes_, other.bytes_);
+    }
+
+    void* data_   = nullptr;
+    size_t bytes_ = 0;
+};
+
+//! \brief file descriptor, closed on destruction
+struct FileHandle
+{
+    explicit FileHandle(int fd_)
+        : fd(fd_)
+    {
+    }
+    FileHandle(const FileHandle&) = delete;
+    ~FileHandle()
+    {
+        if (fd >= 0) { close(fd); }
+    }
+
+    int fd;
+};
+
+//! \brief round \a windowBytes down to a multiple of the page size, at least one page
+inline size_t pageWindowBytes(size_t windowBytes)
+{
+    // the page size is a multiple of sizeof(T), each window holds whole elements
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    return std::max(windowBytes / pageSize, size_t(1)) * pageSize;
+}
+
+//! \brief exclusive scan of the first \a fileBytes of the open file \a fd in place, the next read-write window mapped ahead
+template<class T>
+bool fileExclusiveScanInplace(int fd, size_t fileBytes, size_t windowBytes, T init)
+{
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    windowBytes = pageWindowBytes(windowBytes);
+
+    auto mapWindow = [&](size_t offset)
+    {
+        MappedWindow window(fd, offset, std::min(windowBytes, fileBytes - offset), PROT_READ | PROT_WRITE);
+        window.advise(MADV_SEQUENTIAL);
+        window.advise(MADV_WILLNEED);
+        return window;
+    };
+
+    ChunkedScanner<T> scanner(init);
+
+    MappedWindow nextWindow;
+    if (fileBytes > 0) { nextWindow = mapWindow(0); }
+
+    for (size_t offset = 0; offset < fileBytes; offset += windowBytes)
+    {
+        MappedWindow window = std::move(nextWindow);
+        if (offset + windowBytes < fileBytes) { nextWindow = mapWindow(offset + windowBytes); }
+        if (!window) { return false; }
+
+        scanner.scanChunk(window.data<T>(), window.data<T>(), window.bytes() / sizeof(T));
+    }
+    return true;
+}
+
+/*! \brief exclusive scan of the array of T in file \a inPath into file \a outPath, seeded with \a init
+ *
+ * \a windowBytes is rounded down to a multiple of the page size, at least one page. If \a outPath
+ * names the same file as \a inPath, the file is scanned in place.
+ * \return false if a file cannot be opened or mapped, or if the input size is not a multiple of sizeof(T)
+ */
+template<class T>
+bool fileExclusiveScan(const std::string& inPath, const std::string& outPath, size_t windowBytes = fileWindowBytes,
+                       T init = T(0))
+{
+    FileHandle in(open(inPath.c_str(), O_RDONLY));
+    if (in.fd < 0) { return false; }
+
+    struct stat inStat;
+    if (fstat(in.fd, &inStat) != 0 || inStat.st_size % sizeof(T) != 0) { return false; }
+    size_t fileBytes = inStat.st_size;
+
+    // not truncated on open: the output may be the input under another name
+    FileHandle out(open(outPath.c_str(), O_RDWR | O_CREAT, 0644));
+    struct stat outStat;
+    if (out.fd < 0 || fstat(out.fd, &outStat) != 0) { return false; }
+
+    if (outStat.st_dev == inStat.st_dev && outStat.st_ino == inStat.st_ino)
+    {
+        return fileExclusiveScanInplace(out.fd, fileBytes, windowBytes, init);
+    }
+
+    if (ftruncate(out.fd, 0) != 0 || ftruncate(out.fd, fileBytes) != 0) { return false; }
+
+    posix_fadvise(in.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    windowBytes = pageWindowBytes(windowBytes);
+
+    auto mapInput = [&](size_t offset)
+    {
+        MappedWindow window(in.fd, offset, std::min(windowBytes, fileBytes - offset), PROT_READ);
+        window.advise(MADV_SEQUENTIAL);
+        window.advise(MADV_WILLNEED);
+        return window;
+    };
+
+    ChunkedScanner<T> scanner(init);
+
+    MappedWindow nextInput;
+    if (fileBytes > 0) { nextInput = mapInput(0); }
+
+    for (size_t offset = 0; offset < fileBytes; offset += windowBytes)
+    {
+        MappedWindow input = std::move(nextInput);
+        if (offset + windowBytes < fileBytes) { nextInput = mapInput(offset + windowBytes); }
+
+        MappedWindow output(out.fd, offset, input.bytes(), PROT_READ | PROT_WRITE);
+        if (!input || !output) { return false; }
+        output.advise(MADV_SEQUENTIAL);
+
+        scanner.scanChunk(input.data<T>(), output.data<T>(), input.bytes() / sizeof(T));
+    }
+
+    return true;
+}
+
+} // namespace scan
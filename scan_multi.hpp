@@ -0,0 +1,230 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Exclusive scans of K lanes at once, stored as rows of K (AoS) or as K columns (SoA)
+ *
+ * Scanning K count arrays one after the other costs K parallel regions and K barriers. Here
+ * all lanes share one team and one barrier: the carry of a thread is a vector of K values,
+ * held in one padded ScanContext slot (a single cache line for K * sizeof(T) <= 64). Each
+ * thread reduces all lanes of its contiguous chunk, the lane sums of the preceding threads are
+ * combined after the barrier, and the chunk is scanned once more, seeded with them. The input
+ * is read twice and the output written once, as in v3::reduceThenScan. AoS rows are scanned
+ * row by row with the K carries in one vector register if a row fills 16, 32 or 64 bytes and
+ * in scalar registers otherwise, SoA columns with the simd kernels.
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <array>
+#include <cstring>
+
+#include <omp.h>
+
+#include "scan.hpp"
+#include "scan_context.hpp"
+#include "scan_partition.hpp"
+#include "scan_simd.hpp"
+
+namespace scan
+{
+
+template<class T, int K>
+using Lanes = std::array<T, K>;
+
+//! \brief rows that fill a 16, 32 or 64 byte vector are processed as one vector register per row
+template<int K, class T>
+constexpr bool isVectorRow = simd::isVectorizable<T> && (K * sizeof(T) == 16 || K * sizeof(T) == 32 || K * sizeof(T) == 64);
+
+//! \brief lane-wise sum of the rows in[b:e] of K elements each, added to \a sum
+template<int K, class T>
+Lanes<T, K> reduceRows(const T* in, size_t b, size_t e, Lanes<T, K> sum)
+{
+    if constexpr (isVectorRow<K, T>)
+    {
+        using Row = typename simd::detail::Vec<T, K>::type;
+
+        Row s;
+        std::memcpy(&s, sum.data(), sizeof(Row));
+        for (size_t i = b; i < e; ++i)
+        {
+            Row x;
+            std::memcpy(&x, in + i * K, sizeof(Row));
+            s += x;
+        }
+        std::memcpy(sum.data(), &s, sizeof(Row));
+        return sum;
+    }
+
+    for (size_t i = b; i < e; ++i)
+        for (int k = 0; k < K; ++k)
+            sum[k] += in[i * K + k];
+    return sum;
+}
+
+//! \brief lane-wise exclusive scan of the rows in[b:e] into out, seeded with \a carry
+template<int K, class T>
+Lanes<T, K> exclusiveScanRows(const T* in, T* out, size_t b, size_t e, Lanes<T, K> carry)
+{
+    if constexpr (isVectorRow<K, T>)
+    {
+        using Row = typename simd::detail::Vec<T, K>::type;
+
+        Row c;
+        std::memcpy(&c, carry.data(), sizeof(Row));
+        for (size_t i = b; i < e; ++i)
+        {
+            Row x;
+            std::memcpy(&x, in + i * K, sizeof(Row));
+            std::memcpy(out + i * K, &c, sizeof(Row));
+            c += x;
+        }
+        std::memcpy(carry.data(), &c, sizeof(Row));
+        return carry;
+    }
+
+    for (size_t i = b; i < e; ++i)
+        for (int k = 0; k < K; ++k)
+        {
+            T x            = in[i * K + k];
+            out[i * K + k] = carry[k];
+            carry[k] += x;
+        }
+    return carry;
+}
+
+/*! \brief lane-wise exclusive scan of numRows rows of K elements by all threads of the calling team
+ *
+ * Does not synchronize on exit.
+ * \return init + the lane sums on the last thread of the team, unspecified on the others
+ */
+template<int K, class T>
+Lanes<T, K> exclusiveScanLanesTeam(ScanContext<Lanes<T, K>>& ctx, const T* in, T* out, size_t numRows,
+                                   Lanes<T, K> init)
+{
+    int numThreads = ctx.teamSize();
+    int tid        = omp_get_thread_num();
+
+    Partition part  = Partition::contiguous(numRows, numThreads);
+    size_t rowBegin = part.blockOffset(0, tid);
+    size_t rowEnd   = (tid == numThreads - 1) ? numRows : rowBegin + part.blockSize();
+
+    ctx.carry(0, tid) = reduceRows<K>(in, rowBegin, rowEnd, Lanes<T, K>{});
+
+    #pragma omp barrier
+
+    Lanes<T, K> tSum = init;
+    for (int t = 0; t < tid; ++t)
+        for (int k = 0; k < K; ++k)
+            tSum[k] += ctx.carry(0, t)[k];
+
+    return exclusiveScanRows<K>(in, out, rowBegin, rowEnd, tSum);
+}
+
+/*! \brief lane-wise exclusive scan of numElements columns by all threads of the calling team
+ *
+ * Does not synchronize on exit.
+ * \return init + the column sums on the last thread of the team, unspecified on the others
+ */
+template<int K, class T>
+Lanes<T, K> exclusiveScanColumnsTeam(ScanContext<Lanes<T, K>>& ctx, const T* const* in, T* const* out,
+                                     size_t numElements, Lanes<T, K> init)
+{
+    int numThreads = ctx.teamSize();
+    int tid        = omp_get_thread_num();
+
+    Partition part      = Partition::contiguous(numElements, numThreads);
+    size_t threadOffset = part.blockOffset(0, tid);
+    size_t threadEnd    = (tid == numThreads - 1) ? numElements : threadOffset + part.blockSize();
+    size_t chunkSize    = threadEnd - threadOffset;
+
+    Lanes<T, K>& sums = ctx.carry(0, tid);
+    for (int k = 0; k < K; ++k)
+        sums[k] = simd::reduce(in[k] + threadOffset, chunkSize);
+
+    #pragma omp barrier
+
+    Lanes<T, K> tSum = init;
+    for (int t = 0; t < tid; ++t)
+        for (int k = 0; k < K; ++k)
+            tSum[k] += ctx.carry(0, t)[k];
+
+    for (int k = 0; k < K; ++k)
+        tSum[k] = simd::exclusiveScan(in[k] + threadOffset, out[k] + threadOffset, chunkSize, tSum[k]);
+    return tSum;
+}
+
+/*! \brief lane-wise exclusive scan of numRows rows of K elements each (AoS), e.g. counts of K species per cell
+ *
+ * out[i * K + k] = init[k] + sum(in[j * K + k], j < i). \a in and \a out may be identical,
+ * but must not overlap otherwise.
+ * \return init + the lane sums
+ */
+template<int K, class T>
+Lanes<T, K> exclusiveScanLanes(const T* in, T* out, size_t numRows, Lanes<T, K> init = {})
+{
+    int numThreads = scanThreads(numRows * K * sizeof(T), omp_get_max_threads());
+    if (numThreads == 1) { return exclusiveScanRows<K>(in, out, 0, numRows, init); }
+
+    ScanContext<Lanes<T, K>>& ctx = threadContext<Lanes<T, K>>();
+
+    Lanes<T, K> total = init;
+    #pragma omp parallel num_threads(numThreads)
+    {
+        Lanes<T, K> sum = exclusiveScanLanesTeam<K>(ctx, in, out, numRows, init);
+        if (omp_get_thread_num() == omp_get_num_threads() - 1) { total = sum; }
+    }
+    return total;
+}
+
+/*! \brief exclusive scan of the K columns in[k][0:numElements] into out[k] (SoA) with a single barrier
+ *
+ * Each out[k] may be identical to in[k], but must not overlap any other column.
+ * \return init + the column sums
+ */
+template<int K, class T>
+Lanes<T, K> exclusiveScanColumns(const T* const* in, T* const* out, size_t numElements, Lanes<T, K> init = {})
+{
+    int numThreads = scanThreads(numElements * K * sizeof(T), omp_get_max_threads());
+    if (numThreads == 1)
+    {
+        for (int k = 0; k < K; ++k)
+            init[k] = simd::exclusiveScan(in[k], out[k], numElements, init[k]);
+        return init;
+    }
+
+    ScanContext<Lanes<T, K>>& ctx = threadContext<Lanes<T, K>>();
+
+    Lanes<T, K> total = init;
+    #pragma omp parallel num_threads(numThreads)
+    {
+        Lanes<T, K> sum = exclusiveScanColumnsTeam<K>(ctx, in, out, numElements, init);
+        if (omp_get_thread_num() == omp_get_num_threads() - 1) { total = sum; }
+    }
+    return total;
+}
+
+} // namespace scan
@@ -0,0 +1,250 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Parallel scans with a generic associative operator and fused outputs
+ *
+ * fusedScan computes the exclusive scan, the inclusive scan and the total of an input under
+ * any associative operator in one parallel pass; either output may be omitted. The operator
+ * need not be commutative, carries are always applied from the left. The team body follows
+ * the write-once pipeline of v1: each block is reduced, the block reductions are combined
+ * across the team with the superBlock carries, and the block is then scanned with its final
+ * prefix as seed while it is still in cache. The input is read from memory once and each
+ * output written once.
+ *
+ * Plus, Max, Min, BitOr and ArgMax provide the operator and its identity for the common cases,
+ * any callable with an identity value may be used. For Plus the range kernels dispatch to the
+ * simd kernels, other operators run scalar loops per block.
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+#include <omp.h>
+
+#include "scan.hpp"
+#include "scan_context.hpp"
+#include "scan_partition.hpp"
+#include "scan_simd.hpp"
+#include "scan_v1.hpp"
+
+namespace scan
+{
+
+template<class T>
+struct Plus
+{
+    T operator()(const T& a, const T& b) const { return a + b; }
+    static T identity() { return T(0); }
+};
+
+//! \brief the smallest value of T, -infinity for floating-point types
+template<class T>
+T lowestValue()
+{
+    if constexpr (std::numeric_limits<T>::has_infinity) { return -std::numeric_limits<T>::infinity(); }
+    else { return std::numeric_limits<T>::lowest(); }
+}
+
+//! \brief the largest value of T, +infinity for floating-point types
+template<class T>
+T highestValue()
+{
+    if constexpr (std::numeric_limits<T>::has_infinity) { return std::numeric_limits<T>::infinity(); }
+    else { return std::numeric_limits<T>::max(); }
+}
+
+template<class T>
+struct Max
+{
+    T operator()(const T& a, const T& b) const { return a < b ? b : a; }
+    static T identity() { return lowestValue<T>(); }
+};
+
+template<class T>
+struct Min
+{
+    T operator()(const T& a, const T& b) const { return b < a ? b : a; }
+    static T identity() { return highestValue<T>(); }
+};
+
+template<class T>
+struct BitOr
+{
+    T operator()(const T& a, const T& b) const { return a | b; }
+    static T identity() { return T(0); }
+};
+
+//! \brief maximum of (value, index) pairs, ties resolve to the leftmost element
+template<class V, class I>
+struct ArgMax
+{
+    using T = std::pair<V, I>;
+
+    T operator()(const T& a, const T& b) const { return a.first < b.first ? b : a; }
+    static T identity() { return {lowestValue<V>(), I(0)}; }
+};
+
+/*! \brief scan of in[0:n] under \a op seeded with \a init into \a excl and \a incl, either may be null
+ *
+ * Both outputs may be identical to \a in.
+ * \return op(init, in[0], ..., in[n-1])
+ */
+template<class T, class Op>
+T scanOpRange(const T* in, T* excl, T* incl, size_t n, T init, const Op& op)
+{
+    if constexpr (std::is_same_v<Op, Plus<T>>)
+    {
+        if (excl && !incl) { return simd::exclusiveScan(in, excl, n, init); }
+        if (incl && !excl) { return simd::inclusiveScan(in, incl, n, init); }
+    }
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        T x = in[i];
+        if (excl) { excl[i] = init; }
+        init = op(init, x);
+        if (incl) { incl[i] = init; }
+    }
+    return init;
+}
+
+//! \brief op(init, in[0], ..., in[n-1])
+template<class T, class Op>
+T reduceOpRange(const T* in, size_t n, T init, const Op& op)
+{
+    if constexpr (std::is_same_v<Op, Plus<T>>) { return init + simd::reduce(in, n); }
+
+    for (size_t i = 0; i < n; ++i)
+        init = op(init, in[i]);
+    return init;
+}
+
+/*! \brief fused scan of in[0:numElements] by all threads of the calling team, decomposed according to \a part
+ *
+ * Does not synchronize on exit.
+ * \return the total on the last thread of the team, unspecified on the others
+ */
+template<class T, class Op>
+T fusedScanTeam(ScanContext<T>& ctx, const T* in, T* excl, T* incl, size_t numElements, T init, const Op& op,
+                const Partition& part)
+{
+    int numThreads = ctx.teamSize();
+    int tid        = omp_get_thread_num();
+
+    size_t blockSize = part.blockSize();
+    size_t nSteps    = part.numSteps(numElements);
+
+    if (tid == numThreads - 1) { ctx.carry(1, numThreads) = init; }
+
+    T stepSum = init;
+    for (size_t step = 0; step < nSteps; ++step)
+    {
+        size_t stepOffset = part.blockOffset(step, tid);
+        const T* block    = in + stepOffset;
+
+        // fold from the first element, the operator needs no identity
+        ctx.carry(step%2, tid) = reduceOpRange(block + 1, blockSize - 1, block[0], op);
+
+        #pragma omp barrier
+
+        T tSum = ctx.carry((step+1)%2, numThreads);
+        for (int t = 0; t < tid; ++t)
+            tSum = op(tSum, ctx.carry(step%2, t));
+
+        if (tid == numThreads - 1)
+        {
+            stepSum = op(tSum, ctx.carry(step%2, numThreads - 1));
+            ctx.carry(step%2, numThreads) = stepSum;
+        }
+
+        scanOpRange(block, excl ? excl + stepOffset : nullptr, incl ? incl + stepOffset : nullptr, blockSize, tSum, op);
+    }
+
+    // remainder
+    if (tid == numThreads - 1)
+    {
+        size_t remOffset = part.remainderOffset(numElements);
+        stepSum = scanOpRange(in + remOffset, excl ? excl + remOffset : nullptr, incl ? incl + remOffset : nullptr,
+                              numElements - remOffset, stepSum, op);
+    }
+    return stepSum;
+}
+
+/*! \brief exclusive and inclusive scan of in[0:numElements] under \a op in one pass
+ *
+ * excl[i] = op(init, in[0], ..., in[i-1]) and incl[i] = op(init, in[0], ..., in[i]), where \a init
+ * is the identity of \a op for a plain scan. \a excl and \a incl may be null to skip the output,
+ * and may be identical to \a in, but must not overlap otherwise. \a op must be associative and
+ * is called concurrently by all threads.
+ *
+ * \return op(init, in[0], ..., in[numElements-1])
+ */
+template<class T, class Op>
+T fusedScan(const T* in, T* excl, T* incl, size_t numElements, T init, const Op& op)
+{
+    if (numElements == 0) { return init; }
+
+    int numThreads = scanThreads(numElements * sizeof(T), omp_get_max_threads());
+    if (numThreads == 1) { return scanOpRange(in, excl, incl, numElements, init, op); }
+
+    ScanContext<T>& ctx = threadContext<T>();
+
+    T total = init;
+    #pragma omp parallel num_threads(numThreads)
+    {
+        Partition part = v1::partition<T, blockPages>(omp_get_num_threads());
+        T sum          = fusedScanTeam(ctx, in, excl, incl, numElements, init, op, part);
+        if (omp_get_thread_num() == omp_get_num_threads() - 1) { total = sum; }
+    }
+    return total;
+}
+
+//! \brief fusedScan with identity and operator given by \a op, e.g. Max<float>{}
+template<class T, class Op>
+T fusedScan(const T* in, T* excl, T* incl, size_t numElements, const Op& op)
+{
+    return fusedScan(in, excl, incl, numElements, Op::identity(), op);
+}
+
+//! \brief out[i] = op(init, in[0], ..., in[i-1])
+template<class T, class Op>
+T exclusiveScanOp(const T* in, T* out, size_t numElements, T init, const Op& op)
+{
+    return fusedScan(in, out, (T*)nullptr, numElements, init, op);
+}
+
+//! \brief out[i] = op(init, in[0], ..., in[i])
+template<class T, class Op>
+T inclusiveScanOp(const T* in, T* out, size_t numElements, T init, const Op& op)
+{
+    return fusedScan(in, (T*)nullptr, out, numElements, init, op);
+}
+
+} // namespace scan
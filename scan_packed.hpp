@@ -0,0 +1,373 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Delta encoding with bit-packed or varint blocks and a fused parallel decode-scan
+ *
+ * A sorted index or offset array is stored as the differences of consecutive values, in blocks
+ * of packedBlockSize deltas. Each block is packed either with the smallest fixed bit width that
+ * holds all of its deltas, or as LEB128 varints. The block header holds the byte offset of the
+ * block in the payload, its bit width and its base, the decoded value preceding the block.
+ * With the base in the header every block decodes on its own, threads start at any block
+ * without a reduction pass or a barrier.
+ *
+ * Bit-packed blocks use a vertical layout: the deltas form rows of packedLanes<T> consecutive
+ * elements, 32 bytes wide, and lane k of all rows is packed into its own stream of words,
+ * interleaved with the other lanes word by word. A row is thus unpacked with vector shifts
+ * and masks alone, scanned in the register, offset by the carry of the previous row and
+ * stored, all in one pass over the output. Varint blocks are decoded into an L1 tile and scanned
+ * from there with the simd kernels. No full-width delta array is written in either case, the
+ * input traffic shrinks by the compression ratio.
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include <omp.h>
+
+#include "scan.hpp"
+#include "scan_simd.hpp"
+
+namespace scan
+{
+
+//! \brief number of deltas per packed block
+constexpr size_t packedBlockSize = 1024;
+//! \brief bit width marking a block of LEB128 varints
+constexpr uint32_t varintBits = 255;
+//! \brief bytes per row of a bit-packed block, part of the format
+constexpr size_t packedRowBytes = 32;
+
+//! \brief number of lanes of a bit-packed row
+template<class T>
+constexpr int packedLanes = packedRowBytes / sizeof(T);
+
+template<class T>
+struct PackedBlock
+{
+    //! \brief byte offset of the block's deltas in the payload
+    uint64_t offset;
+    //! \brief decoded value preceding the block, the carry into it
+    T base;
+    //! \brief bit width of the deltas, or varintBits
+    uint32_t bits;
+};
+
+template<class T>
+struct PackedDeltas
+{
+    size_t numElements = 0;
+    std::vector<PackedBlock<T>> blocks;
+    //! \brief packed deltas of all blocks, followed by one row of padding read ahead by the decoder
+    std::vector<uint8_t> payload;
+
+    //! \brief bytes read by a decode, compare to numElements * sizeof(T)
+    size_t bytes() const { return payload.size() + blocks.size() * sizeof(PackedBlock<T>); }
+};
+
+//! \brief the number of bytes of \a x as LEB128 varint
+template<class T>
+size_t varintSize(T x)
+{
+    size_t size = 1;
+    for (; x >= 0x80; x >>= 7)
+        ++size;
+    return size;
+}
+
+//! \brief the number of payload bytes of n deltas of \a bits bits each in the vertical layout
+template<class T>
+size_t packedBytes(uint32_t bits, size_t n)
+{
+    size_t rows  = (n + packedLanes<T> - 1) / packedLanes<T>;
+    size_t words = (rows * bits + 8 * sizeof(T) - 1) / (8 * sizeof(T));
+    return words * packedRowBytes;
+}
+
+namespace detail
+{
+
+/*! \brief unpack n bit-packed deltas from \a in and store their inclusive scan, seeded with \a carry, to \a out
+ *
+ * \return carry + sum of the deltas
+ */
+template<class T, int W>
+[[gnu::always_inline]] inline T unpackScanKernel(const uint8_t* in, uint32_t bits, T* out, size_t n, T carry)
+{
+    using V                     = typename simd::detail::Vec<T, W>::type;
+    constexpr uint32_t wordBits = 8 * sizeof(T);
+
+    V mask = V{} + ((bits == wordBits) ? ~T(0) : (T(1) << bits) - T(1));
+    V c    = V{} + carry;
+
+    V word;
+    std::memcpy(&word, in, sizeof(V));
+    in += sizeof(V);
+    uint32_t shift = 0;
+
+    for (size_t i = 0; i < n; i += W)
+    {
+        V x = word >> shift;
+        shift += bits;
+        if (shift >= wordBits)
+        {
+            // the next word is loaded eagerly, at the end of the block it falls into the padding
+            std::memcpy(&word, in, sizeof(V));
+            in += sizeof(V);
+            shift -= wordBits;
+            if (shift > 0) { x |= word << (bits - shift); }
+        }
+        x &= mask;
+
+        simd::detail::inclusiveScanRegister<T, W>(x);
+        x += c;
+        if (i + W <= n) { std::memcpy(out + i, &x, sizeof(V)); }
+        else { std::memcpy(out + i, &x, (n - i) * sizeof(T)); }
+        c = V{} + x[W - 1];
+    }
+    return c[0];
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+template<class T>
+[[gnu::target("sse4.1")]] T unpackScanSse4(const uint8_t* in, uint32_t bits, T* out, size_t n, T carry)
+{
+    return unpackScanKernel<T, packedLanes<T>>(in, bits, out, n, carry);
+}
+
+template<class T>
+[[gnu::target("avx2")]] T unpackScanAvx2(const uint8_t* in, uint32_t bits, T* out, size_t n, T carry)
+{
+    return unpackScanKernel<T, packedLanes<T>>(in, bits, out, n, carry);
+}
+
+#endif
+
+} // namespace detail
+
+/*! \brief unpack n deltas of \a bits bits each in the vertical layout and store their inclusive scan, seeded with \a carry
+ *
+ * Rows are 32 bytes wide, the AVX-512 machines run the AVX2 kernel.
+ * \return carry + sum of the deltas
+ */
+template<class T>
+T unpackScan(const uint8_t* in, uint32_t bits, T* out, size_t n, T carry)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    switch (simd::isa())
+    {
+        case simd::Isa::avx512:
+        case simd::Isa::avx2: return detail::unpackScanAvx2(in, bits, out, n, carry);
+        case simd::Isa::sse4: return detail::unpackScanSse4(in, bits, out, n, carry);
+        default: break;
+    }
+#endif
+    return detail::unpackScanKernel<T, packedLanes<T>>(in, bits, out, n, carry);
+}
+
+//! \brief pack n deltas of at most \a bits bits each in the vertical layout, packedBytes(bits, n) bytes
+template<class T>
+void packBits(const T* deltas, uint32_t bits, uint8_t* out, size_t n)
+{
+    constexpr int W             = packedLanes<T>;
+    constexpr uint32_t wordBits = 8 * sizeof(T);
+    using V                     = typename simd::detail::Vec<T, W>::type;
+
+    V word         = V{};
+    uint32_t shift = 0;
+    for (size_t i = 0; i < n; i += W)
+    {
+        V x = V{};
+        std::memcpy(&x, deltas + i, std::min(size_t(W), n - i) * sizeof(T));
+
+        word |= x << shift;
+        shift += bits;
+        if (shift >= wordBits)
+        {
+            std::memcpy(out, &word, sizeof(V));
+            out += sizeof(V);
+            shift -= wordBits;
+            word = (shift > 0) ? x >> (bits - shift) : V{};
+        }
+    }
+    if (shift > 0) { std::memcpy(out, &word, sizeof(V)); }
+}
+
+//! \brief decode n LEB128 varints from \a in into \a out
+template<class T>
+void unpackVarints(const uint8_t* in, T* out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        T x       = 0;
+        int shift = 0;
+        uint8_t byte;
+        do
+        {
+            byte = *in++;
+            x |= T(byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        out[i] = x;
+    }
+}
+
+template<class T>
+void packVarints(const T* deltas, uint8_t* out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        T x = deltas[i];
+        for (; x >= 0x80; x >>= 7)
+            *out++ = uint8_t(x) | 0x80;
+        *out++ = uint8_t(x);
+    }
+}
+
+//! \brief deltas of the values in block \a b, the first relative to the value preceding the block
+template<class T>
+size_t blockDeltas(const T* values, size_t numElements, size_t b, T* deltas)
+{
+    size_t first = b * packedBlockSize;
+    size_t len   = std::min(packedBlockSize, numElements - first);
+
+    T prev = first ? values[first - 1] : T(0);
+    for (size_t i = 0; i < len; ++i)
+    {
+        deltas[i] = values[first + i] - prev;
+        prev      = values[first + i];
+    }
+    return len;
+}
+
+/*! \brief delta-encode values[0:numElements] in bit-packed blocks, or in varint blocks if \a varint is set
+ *
+ * The values are typically sorted; other sequences are encoded correctly through wrap-around
+ * deltas, but do not compress. Blocks are sized and packed in parallel.
+ */
+template<class T>
+PackedDeltas<T> packDeltas(const T* values, size_t numElements, bool varint = false)
+{
+    static_assert(std::is_unsigned_v<T> && (sizeof(T) == 4 || sizeof(T) == 8),
+                  "delta encoding requires 32- or 64-bit unsigned integers");
+
+    PackedDeltas<T> packed;
+    packed.numElements = numElements;
+
+    size_t numBlocks = (numElements + packedBlockSize - 1) / packedBlockSize;
+    packed.blocks.resize(numBlocks);
+    std::vector<uint64_t> blockBytes(numBlocks);
+
+    #pragma omp parallel for schedule(static)
+    for (size_t b = 0; b < numBlocks; ++b)
+    {
+        T deltas[packedBlockSize];
+        size_t len = blockDeltas(values, numElements, b, deltas);
+
+        PackedBlock<T>& block = packed.blocks[b];
+        block.base            = b ? values[b * packedBlockSize - 1] : T(0);
+
+        if (varint)
+        {
+            block.bits  = varintBits;
+            size_t size = 0;
+            for (size_t i = 0; i < len; ++i)
+                size += varintSize(deltas[i]);
+            blockBytes[b] = size;
+        }
+        else
+        {
+            T bitsUsed = 0;
+            for (size_t i = 0; i < len; ++i)
+                bitsUsed |= deltas[i];
+
+            block.bits = 0;
+            for (; block.bits < 8 * sizeof(T) && (bitsUsed >> block.bits) != 0; ++block.bits) {}
+            blockBytes[b] = packedBytes<T>(block.bits, len);
+        }
+    }
+
+    // the payload offsets of the blocks are the exclusive scan of their sizes
+    uint64_t payloadBytes = numBlocks ? blockBytes.back() : 0;
+    exclusiveScan(blockBytes.data(), blockBytes.data(), numBlocks, uint64_t(0));
+    payloadBytes += numBlocks ? blockBytes.back() : 0;
+    packed.payload.resize(payloadBytes + packedRowBytes, 0);
+
+    #pragma omp parallel for schedule(static)
+    for (size_t b = 0; b < numBlocks; ++b)
+    {
+        T deltas[packedBlockSize];
+        size_t len = blockDeltas(values, numElements, b, deltas);
+
+        PackedBlock<T>& block = packed.blocks[b];
+        block.offset          = blockBytes[b];
+
+        uint8_t* out = packed.payload.data() + block.offset;
+        if (block.bits == varintBits) { packVarints(deltas, out, len); }
+        else { packBits(deltas, block.bits, out, len); }
+    }
+
+    return packed;
+}
+
+//! \brief decode block \a b of \a packed into its elements of out[0:packed.numElements]
+template<class T>
+void deltaDecodeBlock(const PackedDeltas<T>& packed, size_t b, T* out)
+{
+    const PackedBlock<T>& block = packed.blocks[b];
+    const uint8_t* in           = packed.payload.data() + block.offset;
+
+    size_t first = b * packedBlockSize;
+    size_t len   = std::min(packedBlockSize, packed.numElements - first);
+
+    if (block.bits == varintBits)
+    {
+        T deltas[packedBlockSize];
+        unpackVarints(in, deltas, len);
+        simd::inclusiveScan(deltas, out + first, len, block.base);
+    }
+    else { unpackScan(in, block.bits, out + first, len, block.base); }
+}
+
+//! \brief decode \a packed into out[0:packed.numElements], the blocks are distributed over the threads without synchronization
+template<class T>
+void deltaDecode(const PackedDeltas<T>& packed, T* out)
+{
+    size_t numBlocks = packed.blocks.size();
+    int numThreads   = scanThreads(packed.numElements * sizeof(T), omp_get_max_threads());
+
+    #pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (size_t b = 0; b < numBlocks; ++b)
+        deltaDecodeBlock(packed, b, out);
+}
+
+} // namespace scan
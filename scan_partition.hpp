@@ -0,0 +1,188 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Thread-to-element mapping of the scan variants and matching first-touch allocation
+ *
+ * A Partition describes which thread processes which elements: blocks of blockSize elements
+ * are dealt out round-robin to the threads, one block per thread and step, and the remainder
+ * after the last complete step belongs to the last thread. v1 and v2 use blocks of NPages,
+ * v3 uses a single step with one block per thread.
+ *
+ * Linux places a page on the NUMA node of the thread that first writes to it. Allocating the
+ * scan buffers with allocateFirstTouch and the partition of the variant that is going to scan
+ * them keeps all element accesses node-local, only the per-thread carries cross nodes.
+ *
+ * Multi-GB buffers on 4 KiB pages miss the TLB on every page. allocateFirstTouch therefore
+ * requests 2 MiB transparent huge pages, but only if the blocks of the partition span at least
+ * one huge page: a huge page is placed as a whole, so smaller blocks of different threads would
+ * share it and could not all be node-local. Otherwise, or if THP is unavailable, the buffer is
+ * aligned to and placed with 4 KiB pages as before. In practice this is the contiguous partition
+ * of v3: the blocks of v1 and v2 are NPages 4 KiB pages, sized to stay in the private caches,
+ * and reach a huge page only for NPages >= 512, which scans slower than the default block sizes
+ * even on huge pages. The block sizes of v1 and v2 therefore do not depend on the page size.
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <stdlib.h>
+#include <string>
+#include <sys/mman.h>
+
+#include <omp.h>
+
+namespace scan
+{
+
+class Partition
+{
+public:
+    //! \brief blocks of \a blockSize elements, assigned round-robin to \a numThreads threads
+    static Partition blockCyclic(size_t blockSize, int numThreads) { return Partition(blockSize, numThreads); }
+
+    //! \brief one contiguous chunk of numElements / numThreads per thread
+    static Partition contiguous(size_t numElements, int numThreads)
+    {
+        return Partition(numElements / numThreads, numThreads);
+    }
+
+    size_t blockSize() const { return blockSize_; }
+    int numThreads() const { return numThreads_; }
+
+    size_t elementsPerStep() const { return blockSize_ * numThreads_; }
+
+    //! \brief number of complete steps of numThreads blocks
+    size_t numSteps(size_t numElements) const { return blockSize_ ? numElements / elementsPerStep() : 0; }
+
+    //! \brief offset of the block of thread \a tid in step \a step
+    size_t blockOffset(size_t step, int tid) const { return step * elementsPerStep() + tid * blockSize_; }
+
+    //! \brief first element of the remainder, processed by the last thread
+    size_t remainderOffset(size_t numElements) const { return numSteps(numElements) * elementsPerStep(); }
+
+    //! \brief call f(begin, end) for every range of elements owned by thread \a tid
+    template<class F>
+    void forEachRange(int tid, size_t numElements, F&& f) const
+    {
+        size_t nSteps = numSteps(numElements);
+        for (size_t step = 0; step < nSteps; ++step)
+        {
+            size_t offset = blockOffset(step, tid);
+            f(offset, offset + blockSize_);
+        }
+        if (tid == numThreads_ - 1) { f(remainderOffset(numElements), numElements); }
+    }
+
+private:
+    Partition(size_t blockSize, int numThreads)
+        : blockSize_(blockSize)
+        , numThreads_(numThreads)
+    {
+    }
+
+    size_t blockSize_;
+    int numThreads_;
+};
+
+constexpr size_t smallPageSize = 4096;
+constexpr size_t hugePageSize  = 2 * 1024 * 1024;
+
+/*! \brief whether the kernel backs madvise'd anonymous memory with transparent huge pages
+ *
+ * Checked once, setting SCAN_HUGE_PAGES=0 disables huge pages.
+ */
+inline bool transparentHugePages()
+{
+    static const bool available = []()
+    {
+        const char* env = std::getenv("SCAN_HUGE_PAGES");
+        if (env && std::string(env) == "0") { return false; }
+
+        std::ifstream sysfs("/sys/kernel/mm/transparent_hugepage/enabled");
+        std::string mode;
+        std::getline(sysfs, mode);
+        return mode.find("[always]") != std::string::npos || mode.find("[madvise]") != std::string::npos;
+    }();
+    return available;
+}
+
+//! \brief page size used for a buffer of \a bytes whose threads own blocks of \a blockBytes
+inline size_t allocationPageSize(size_t bytes, size_t blockBytes)
+{
+    bool huge = transparentHugePages() && bytes >= hugePageSize && blockBytes >= hugePageSize;
+    return huge ? hugePageSize : smallPageSize;
+}
+
+//! \brief set data[0:numElements] to \a value, each element written by the thread that owns it in \a partition
+template<class T>
+void firstTouch(T* data, size_t numElements, const Partition& partition, T value)
+{
+    #pragma omp parallel num_threads(partition.numThreads())
+    {
+        int tid = omp_get_thread_num();
+        if (omp_get_num_threads() == partition.numThreads())
+        {
+            partition.forEachRange(tid, numElements,
+                                   [data, value](size_t b, size_t e) { std::fill(data + b, data + e, value); });
+        }
+        else
+        {
+            #pragma omp single
+            std::fill(data, data + numElements, value);
+        }
+    }
+}
+
+/*! \brief allocate a page-aligned buffer with pages placed on the nodes of the threads that own them
+ *
+ * Backed by huge pages if allocationPageSize selects them, the kernel may still fall back to
+ * 4 KiB pages. The buffer is initialized to \a value and must be released with free().
+ * Returns nullptr if the allocation fails.
+ */
+template<class T>
+T* allocateFirstTouch(size_t numElements, const Partition& partition, T value = T(0))
+{
+    size_t pageSize = allocationPageSize(numElements * sizeof(T), partition.blockSize() * sizeof(T));
+
+    size_t bytes = std::max((numElements * sizeof(T) + pageSize - 1) / pageSize * pageSize, pageSize);
+    T* data      = (T*)aligned_alloc(pageSize, bytes);
+    if (!data && pageSize == hugePageSize)
+    {
+        pageSize = smallPageSize;
+        bytes    = std::max((numElements * sizeof(T) + pageSize - 1) / pageSize * pageSize, pageSize);
+        data     = (T*)aligned_alloc(pageSize, bytes);
+    }
+    if (!data) { return nullptr; }
+    if (pageSize == hugePageSize) { madvise(data, bytes, MADV_HUGEPAGE); }
+
+    firstTouch(data, numElements, partition, value);
+    return data;
+}
+
+} // namespace scan
@@ -0,0 +1,222 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Scan-based parallel primitives: stream compaction, stable partition and bucket scatter
+ *
+ * copyIf fuses predicate, scan and scatter into the block loop of v1: each thread evaluates the
+ * predicate on its block into a flag buffer, the block counts are scanned across the team with
+ * the superBlock carries, and the block is scattered while it is still in cache. The input is
+ * read from memory once and the output written once.
+ *
+ * For a partition or a radix digit the output is bucket-major, so the offset of any element
+ * depends on the totals of all buckets before it and no element can be placed before the whole
+ * input has been counted. bucketScatter therefore makes one counting pass over contiguous
+ * chunks (the v3 decomposition), scans the per-chunk histograms in bucket-major order and then
+ * scatters each chunk, which keeps the result stable.
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+
+#include <omp.h>
+
+#include "scan.hpp"
+#include "scan_context.hpp"
+#include "scan_partition.hpp"
+#include "scan_v1.hpp"
+
+namespace scan
+{
+
+/*! \brief copy the elements of in[0:numElements] that satisfy \a pred to out, by all threads of the calling team
+ *
+ * Does not synchronize on exit.
+ * \return the number of copied elements on the last thread of the team, unspecified on the others
+ */
+template<class T, class Pred>
+size_t copyIfTeam(ScanContext<size_t>& ctx, const T* in, T* out, size_t numElements, const Pred& pred,
+                  const Partition& part)
+{
+    int numThreads = ctx.teamSize();
+    int tid        = omp_get_thread_num();
+
+    size_t blockSize = part.blockSize();
+    size_t nSteps    = part.numSteps(numElements);
+
+    std::unique_ptr<uint8_t[]> flags(new uint8_t[blockSize]);
+
+    if (tid == numThreads - 1) { ctx.carry(1, numThreads) = 0; }
+
+    size_t stepSum = 0;
+    for (size_t step = 0; step < nSteps; ++step)
+    {
+        const T* block = in + part.blockOffset(step, tid);
+
+        size_t count = 0;
+        for (size_t i = 0; i < blockSize; ++i)
+        {
+            flags[i] = pred(block[i]);
+            count += flags[i];
+        }
+        ctx.carry(step%2, tid) = count;
+
+        #pragma omp barrier
+
+        size_t tSum = ctx.carry((step+1)%2, numThreads);
+        for (int t = 0; t < tid; ++t)
+            tSum += ctx.carry(step%2, t);
+
+        if (tid == numThreads - 1)
+        {
+            stepSum = tSum + ctx.carry(step%2, numThreads - 1);
+            ctx.carry(step%2, numThreads) = stepSum;
+        }
+
+        for (size_t i = 0; i < blockSize; ++i)
+        {
+            if (flags[i]) { out[tSum++] = block[i]; }
+        }
+    }
+
+    // remainder
+    if (tid == numThreads - 1)
+    {
+        for (size_t i = part.remainderOffset(numElements); i < numElements; ++i)
+        {
+            if (pred(in[i])) { out[stepSum++] = in[i]; }
+        }
+    }
+    return stepSum;
+}
+
+/*! \brief copy the elements of in[0:numElements] that satisfy \a pred to out, preserving their order
+ *
+ * \a pred is evaluated once per element, concurrently by all threads. \a in and \a out must not overlap.
+ * \return the number of copied elements
+ */
+template<class T, class Pred>
+size_t copyIf(const T* in, T* out, size_t numElements, const Pred& pred)
+{
+    int numThreads = scanThreads(numElements * sizeof(T), omp_get_max_threads());
+    ScanContext<size_t>& ctx = threadContext<size_t>();
+
+    size_t numCopied = 0;
+    #pragma omp parallel num_threads(numThreads)
+    {
+        Partition part = v1::partition<T, blockPages>(omp_get_num_threads());
+        size_t count   = copyIfTeam(ctx, in, out, numElements, pred, part);
+        if (omp_get_thread_num() == omp_get_num_threads() - 1) { numCopied = count; }
+    }
+    return numCopied;
+}
+
+//! \brief per-thread histogram and scatter offsets of bucketScatterTeam, padded to whole cache lines
+template<int NumBuckets>
+struct alignas(64) BucketCounts
+{
+    size_t histogram[NumBuckets];
+    size_t offsets[NumBuckets];
+};
+
+/*! \brief stable scatter of in[0:numElements] into buckets, by all threads of the calling team
+ *
+ * \a counts is shared by the team and holds one BucketCounts per thread. If
+ * \a bucketOffsets is not null, the start of each bucket and the total number of elements are
+ * written to bucketOffsets[0:NumBuckets+1]. Does not synchronize on exit.
+ */
+template<int NumBuckets, class T, class BucketOf>
+void bucketScatterTeam(BucketCounts<NumBuckets>* counts, const T* in, T* out, size_t numElements, const BucketOf& bucketOf,
+                       size_t* bucketOffsets)
+{
+    int numThreads = omp_get_num_threads();
+    int tid        = omp_get_thread_num();
+
+    Partition part      = Partition::contiguous(numElements, numThreads);
+    size_t threadOffset = part.blockOffset(0, tid);
+    size_t threadEnd    = (tid == numThreads - 1) ? numElements : threadOffset + part.blockSize();
+
+    size_t* histogram = counts[tid].histogram;
+    std::fill(histogram, histogram + NumBuckets, size_t(0));
+    for (size_t i = threadOffset; i < threadEnd; ++i)
+        ++histogram[bucketOf(in[i])];
+
+    #pragma omp barrier
+
+    // bucket-major exclusive scan of the histograms: all of bucket b precedes bucket b+1
+    size_t* offsets    = counts[tid].offsets;
+    size_t bucketStart = 0;
+    for (int b = 0; b < NumBuckets; ++b)
+    {
+        size_t before = 0, total = 0;
+        for (int t = 0; t < numThreads; ++t)
+        {
+            size_t c = counts[t].histogram[b];
+            if (t < tid) { before += c; }
+            total += c;
+        }
+        if (tid == 0 && bucketOffsets) { bucketOffsets[b] = bucketStart; }
+        offsets[b] = bucketStart + before;
+        bucketStart += total;
+    }
+    if (tid == 0 && bucketOffsets) { bucketOffsets[NumBuckets] = bucketStart; }
+
+    for (size_t i = threadOffset; i < threadEnd; ++i)
+        out[offsets[bucketOf(in[i])]++] = in[i];
+}
+
+/*! \brief stable scatter of in[0:numElements] into the NumBuckets buckets given by bucketOf(element)
+ *
+ * This is one pass of an LSD radix sort if bucketOf extracts a digit. \a bucketOf is evaluated
+ * twice per element and must return values in [0, NumBuckets). \a in and \a out must not overlap.
+ *
+ * \param bucketOffsets  if not null, receives the NumBuckets + 1 bucket start offsets
+ */
+template<int NumBuckets, class T, class BucketOf>
+void bucketScatter(const T* in, T* out, size_t numElements, const BucketOf& bucketOf, size_t* bucketOffsets = nullptr)
+{
+    int numThreads = scanThreads(numElements * sizeof(T), omp_get_max_threads());
+    std::unique_ptr<BucketCounts<NumBuckets>[]> counts(new BucketCounts<NumBuckets>[numThreads]);
+
+    #pragma omp parallel num_threads(numThreads)
+    bucketScatterTeam<NumBuckets>(counts.get(), in, out, numElements, bucketOf, bucketOffsets);
+}
+
+/*! \brief stable partition of in[0:numElements] into out, the elements that satisfy \a pred first
+ *
+ * \return the number of elements that satisfy \a pred
+ */
+template<class T, class Pred>
+size_t stablePartition(const T* in, T* out, size_t numElements, const Pred& pred)
+{
+    size_t bucketOffsets[3];
+    bucketScatter<2>(in, out, numElements, [&pred](const T& x) { return pred(x) ? 0 : 1; }, bucketOffsets);
+    return bucketOffsets[1];
+}
+
+} // namespace scan
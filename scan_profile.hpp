@@ -0,0 +1,223 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Opt-in per-thread phase instrumentation of the scan team bodies
+ *
+ * Compile with -DSCAN_PROFILE to enable. The team bodies mark the end of each phase (local
+ * scan, reduction, barrier wait, shift) with SCAN_PROFILE_LAP, which adds the time stamp
+ * counter ticks since the previous mark and the bytes moved in the phase to the calling
+ * thread's counters. Counters are padded to cache lines. Without SCAN_PROFILE the macros
+ * expand to nothing and their arguments are not evaluated.
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace scan
+{
+namespace profile
+{
+
+#ifdef SCAN_PROFILE
+constexpr bool enabled = true;
+#else
+constexpr bool enabled = false;
+#endif
+
+enum Phase : int
+{
+    localScan = 0,
+    reduce    = 1,
+    barrier   = 2,
+    shift     = 3,
+    numPhases = 4
+};
+
+inline const char* phaseName(int phase)
+{
+    constexpr const char* names[numPhases] = {"scan", "reduce", "barrier", "shift"};
+    return names[phase];
+}
+
+struct alignas(64) ThreadCounters
+{
+    uint64_t ticks[numPhases];
+    uint64_t bytes[numPhases];
+};
+
+inline uint64_t ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+//! \brief tick rate, calibrated against the steady clock on first use
+inline double ticksPerSecond()
+{
+    static const double rate = []()
+    {
+        auto tp0 = std::chrono::steady_clock::now();
+        uint64_t t0 = ticks();
+        while (std::chrono::steady_clock::now() - tp0 < std::chrono::milliseconds(20)) {}
+        uint64_t t1 = ticks();
+        auto tp1 = std::chrono::steady_clock::now();
+        return (t1 - t0) / std::chrono::duration<double>(tp1 - tp0).count();
+    }();
+    return rate;
+}
+
+//! \brief one counter set per thread, threads beyond omp_get_max_threads() at first use are not recorded
+inline std::vector<ThreadCounters>& counters()
+{
+    static std::vector<ThreadCounters> c(omp_get_max_threads(), ThreadCounters{});
+    return c;
+}
+
+//! \brief clear all counters, must not be called concurrently with instrumented scans
+inline void reset() { std::fill(counters().begin(), counters().end(), ThreadCounters{}); }
+
+//! \brief time stamp of the end of the previous phase of the calling thread
+class Lap
+{
+public:
+    Lap()
+        : start_(ticks())
+    {
+    }
+
+    //! \brief attribute the time since the previous mark and \a bytes to \a phase
+    void record(Phase phase, size_t bytes)
+    {
+        uint64_t now = ticks();
+        size_t tid   = omp_get_thread_num();
+        if (tid < counters().size())
+        {
+            counters()[tid].ticks[phase] += now - start_;
+            counters()[tid].bytes[phase] += bytes;
+        }
+        start_ = now;
+    }
+
+private:
+    uint64_t start_;
+};
+
+/*! \brief per-thread time per phase, followed by the load imbalance and bandwidth of each phase
+ *
+ * Imbalance is the slowest thread's time over the mean, bandwidth the total bytes of the phase
+ * over the slowest thread's time, as the team waits for it at the next barrier.
+ */
+inline void report(std::ostream& out)
+{
+    if (!enabled)
+    {
+        out << "scan profile: compile with -DSCAN_PROFILE to enable\n";
+        return;
+    }
+
+    const auto& c = counters();
+    double rate   = ticksPerSecond();
+
+    std::vector<int> threads;
+    for (size_t t = 0; t < c.size(); ++t)
+    {
+        uint64_t total = 0;
+        for (int p = 0; p < numPhases; ++p)
+            total += c[t].ticks[p];
+        if (total) { threads.push_back(t); }
+    }
+    if (threads.empty())
+    {
+        out << "scan profile: no samples\n";
+        return;
+    }
+
+    out << std::fixed << std::setprecision(3);
+    out << std::setw(10) << "thread";
+    for (int p = 0; p < numPhases; ++p)
+        out << std::setw(12) << (std::string(phaseName(p)) + " ms");
+    out << "\n";
+
+    for (int t : threads)
+    {
+        out << std::setw(10) << t;
+        for (int p = 0; p < numPhases; ++p)
+            out << std::setw(12) << 1e3 * c[t].ticks[p] / rate;
+        out << "\n";
+    }
+
+    for (int p = 0; p < numPhases; ++p)
+    {
+        uint64_t maxTicks = 0, sumTicks = 0, bytes = 0;
+        int slowest = threads[0];
+        for (int t : threads)
+        {
+            sumTicks += c[t].ticks[p];
+            bytes += c[t].bytes[p];
+            if (c[t].ticks[p] > maxTicks)
+            {
+                maxTicks = c[t].ticks[p];
+                slowest  = t;
+            }
+        }
+        if (maxTicks == 0) { continue; }
+
+        double mean = double(sumTicks) / threads.size();
+        out << std::setw(10) << phaseName(p) << ": imbalance " << maxTicks / mean << ", slowest thread " << slowest;
+        if (bytes) { out << ", " << bytes / (maxTicks / rate) / 1e9 << " GB/s"; }
+        out << "\n";
+    }
+    out << std::defaultfloat;
+}
+
+} // namespace profile
+} // namespace scan
+
+#ifdef SCAN_PROFILE
+#define SCAN_PROFILE_START() scan::profile::Lap scanProfileLap_
+#define SCAN_PROFILE_LAP(phase, bytes) scanProfileLap_.record(scan::profile::phase, bytes)
+#else
+#define SCAN_PROFILE_START()
+#define SCAN_PROFILE_LAP(phase, bytes)
+#endif
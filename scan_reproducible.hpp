@@ -0,0 +1,144 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Floating-point scan with results independent of the thread count
+ *
+ * The parallel variants add up the block carries in the order given by their decomposition,
+ * so for floating-point types the rounding, and with it the result, changes with the number of
+ * threads and the block size. Here the input is cut into blocks of a fixed number of elements
+ * that does not depend on the team. Every value is computed from the contents of one block and
+ * its carry only: the block sum by the reduce kernel, the carries by one compensated
+ * (Neumaier) summation of the block sums in block order, and the output by a scan of the block
+ * seeded with its carry. Threads own contiguous ranges of whole blocks; each thread repeats the
+ * carry summation from the first block up to its own, which costs one addition per preceding
+ * block, about 1 / reproducibleBlockSize of the scan.
+ *
+ * The input is read twice and the output written once, as in v3::reduceThenScan, but without
+ * streaming stores. Results are bitwise identical for any thread count and any alignment of
+ * the buffers on machines that select the same simd kernel ISA.
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <vector>
+
+#include <omp.h>
+
+#include "scan.hpp"
+#include "scan_partition.hpp"
+#include "scan_simd.hpp"
+
+namespace scan
+{
+
+//! \brief number of elements per block of the reproducible scan, part of the definition of its result
+template<class T>
+constexpr size_t reproducibleBlockSize = 16384 / sizeof(T);
+
+//! \brief running sum with Neumaier compensation for floating-point types, a plain sum otherwise
+template<class T>
+struct CompensatedSum
+{
+    T sum;
+    T comp = T(0);
+
+    void add(T x)
+    {
+        T t = sum + x;
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            if (std::abs(sum) >= std::abs(x)) { comp += (sum - t) + x; }
+            else { comp += (x - t) + sum; }
+        }
+        sum = t;
+    }
+
+    T value() const { return sum + comp; }
+};
+
+/*! \brief reproducible exclusive scan of in[0:numElements] by all threads of the calling team
+ *
+ * \a blockSums is shared by the team and has space for one sum per block. Does not synchronize on exit.
+ */
+template<class T>
+void reproducibleExclusiveScanTeam(T* blockSums, const T* in, T* out, size_t numElements, T init)
+{
+    constexpr size_t blockSize = reproducibleBlockSize<T>;
+
+    int numThreads = omp_get_num_threads();
+    int tid        = omp_get_thread_num();
+
+    size_t numBlocks = (numElements + blockSize - 1) / blockSize;
+
+    Partition part    = Partition::contiguous(numBlocks, numThreads);
+    size_t blockBegin = part.blockOffset(0, tid);
+    size_t blockEnd   = (tid == numThreads - 1) ? numBlocks : blockBegin + part.blockSize();
+
+    for (size_t b = blockBegin; b < blockEnd; ++b)
+    {
+        size_t offset = b * blockSize;
+        blockSums[b]  = simd::reduce(in + offset, std::min(blockSize, numElements - offset));
+    }
+
+    #pragma omp barrier
+
+    CompensatedSum<T> carry{init};
+    for (size_t b = 0; b < blockBegin; ++b)
+        carry.add(blockSums[b]);
+
+    // not the streaming kernel: its scalar prologue depends on the alignment of out, and with it the rounding
+    for (size_t b = blockBegin; b < blockEnd; ++b)
+    {
+        size_t offset = b * blockSize;
+        simd::exclusiveScan(in + offset, out + offset, std::min(blockSize, numElements - offset), carry.value());
+        carry.add(blockSums[b]);
+    }
+}
+
+/*! \brief exclusive scan of in[0:numElements] into out whose result does not depend on the number of threads
+ *
+ * Intended for floating-point types, where it also reduces the rounding error of the carries
+ * through compensated summation. \a in and \a out may be identical, but must not overlap otherwise.
+ */
+template<class T>
+void reproducibleExclusiveScan(const T* in, T* out, size_t numElements, T init = T(0))
+{
+    if (numElements == 0) { return; }
+
+    size_t numBlocks = (numElements + reproducibleBlockSize<T> - 1) / reproducibleBlockSize<T>;
+    int numThreads   = std::min(scanThreads(numElements * sizeof(T), omp_get_max_threads()), int(numBlocks));
+
+    std::vector<T> blockSums(numBlocks);
+
+    #pragma omp parallel num_threads(numThreads)
+    reproducibleExclusiveScanTeam(blockSums.data(), in, out, numElements, init);
+}
+
+} // namespace scan
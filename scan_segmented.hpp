@@ -0,0 +1,264 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Segmented and batched parallel exclusive scan
+ *
+ * The scan restarts from zero at every segment head. Segments are given either as head flags
+ * or as an array of segment start offsets. The decomposition is that of v1: each thread scans
+ * one block per step, segment by segment, and publishes the sum after the last head in its
+ * block together with whether the block contains a head. After the barrier, the carry into a
+ * block is accumulated from the preceding blocks back to the nearest one with a head, and only
+ * the leading part of the block up to its first head needs to be shifted.
+ *
+ * A batch of independent arrays in CSR form is a segmented scan with the CSR offsets as segment
+ * starts. batchedExclusiveScan uses the single-step contiguous decomposition of v3 for it.
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <algorithm>
+
+#include <omp.h>
+
+#include "scan.hpp"
+#include "scan_context.hpp"
+#include "scan_partition.hpp"
+#include "scan_simd.hpp"
+#include "scan_v1.hpp"
+
+namespace scan
+{
+
+//! \brief carry of a block in a segmented scan
+template<class T>
+struct SegmentCarry
+{
+    //! \brief sum of the elements after the last head in the block, or of all elements if there is none
+    T sum;
+    //! \brief whether the block contains a segment head
+    bool head;
+};
+
+//! \brief segment heads given as flags, element i starts a segment if flags[i] is true
+template<class F>
+struct HeadFlags
+{
+    struct Cursor
+    {
+        //! \brief return the next head in the range, or its end
+        size_t next()
+        {
+            while (i < end && !flags[i])
+                ++i;
+            return (i < end) ? i++ : end;
+        }
+
+        const F* flags;
+        size_t i, end;
+    };
+
+    //! \brief cursor over the heads in [b, e)
+    Cursor cursor(size_t b, size_t e) const { return {flags, b, e}; }
+
+    const F* flags;
+};
+
+//! \brief segment heads given as sorted start offsets, duplicates (empty segments) are allowed
+template<class I>
+struct HeadOffsets
+{
+    struct Cursor
+    {
+        size_t next()
+        {
+            while (it != last && size_t(*it) < pos)
+                ++it;
+            if (it == last || size_t(*it) >= end) { return end; }
+
+            size_t head = *it;
+            pos         = head + 1;
+            return head;
+        }
+
+        const I* it;
+        const I* last;
+        size_t pos, end;
+    };
+
+    Cursor cursor(size_t b, size_t e) const
+    {
+        return {std::lower_bound(offsets, offsets + numOffsets, I(b)), offsets + numOffsets, b, e};
+    }
+
+    const I* offsets;
+    size_t numOffsets;
+};
+
+/*! \brief segmented exclusive scan of in[b:e] into out[b:e], the first segment is seeded with \a init
+ *
+ * \return carry of the range
+ */
+template<class T, class Heads>
+SegmentCarry<T> segmentedScanRange(const T* in, T* out, size_t b, size_t e, const Heads& heads, T init)
+{
+    auto cursor = heads.cursor(b, e);
+    size_t h    = cursor.next();
+
+    SegmentCarry<T> carry{simd::exclusiveScan(in + b, out + b, h - b, init), h < e};
+    while (h < e)
+    {
+        size_t nextHead = cursor.next();
+        carry.sum       = simd::exclusiveScan(in + h, out + h, nextHead - h, T(0));
+        h               = nextHead;
+    }
+    return carry;
+}
+
+/*! \brief segmented exclusive scan by all threads of the calling team, decomposed according to \a part
+ *
+ * Does not synchronize on exit.
+ */
+template<class T, class Heads>
+void segmentedExclusiveScanTeam(ScanContext<SegmentCarry<T>>& ctx, const T* in, T* out, size_t numElements,
+                                const Heads& heads, const Partition& part)
+{
+    int numThreads = ctx.teamSize();
+    int tid        = omp_get_thread_num();
+
+    size_t blockSize = part.blockSize();
+    size_t nSteps    = part.numSteps(numElements);
+
+    // carry of everything before the current step
+    if (tid == numThreads - 1) { ctx.carry(1, numThreads) = {T(0), true}; }
+
+    T stepSum = 0;
+    for (size_t step = 0; step < nSteps; ++step)
+    {
+        size_t stepOffset = part.blockOffset(step, tid);
+        size_t firstHead  = heads.cursor(stepOffset, stepOffset + blockSize).next();
+
+        ctx.carry(step%2, tid) = segmentedScanRange(in, out, stepOffset, stepOffset + blockSize, heads, T(0));
+
+        #pragma omp barrier
+
+        T carryIn = 0;
+        bool done = false;
+        for (int t = tid - 1; t >= 0 && !done; --t)
+        {
+            carryIn += ctx.carry(step%2, t).sum;
+            done = ctx.carry(step%2, t).head;
+        }
+        if (!done) { carryIn += ctx.carry((step+1)%2, numThreads).sum; }
+
+        if (tid == numThreads - 1)
+        {
+            SegmentCarry<T> last = ctx.carry(step%2, tid);
+            stepSum = last.head ? last.sum : carryIn + last.sum;
+            ctx.carry(step%2, numThreads) = {stepSum, true};
+        }
+
+        simd::addShift(out + stepOffset, firstHead - stepOffset, carryIn);
+    }
+
+    // remainder
+    if (tid == numThreads - 1)
+    {
+        segmentedScanRange(in, out, part.remainderOffset(numElements), numElements, heads, stepSum);
+    }
+}
+
+//! \brief segmented exclusive scan with segment heads given by \a heads, e.g. HeadFlags or HeadOffsets
+template<class T, class Heads>
+void segmentedExclusiveScanHeads(const T* in, T* out, size_t numElements, const Heads& heads)
+{
+    int numThreads = scanThreads(numElements * sizeof(T), omp_get_max_threads());
+    if (numThreads == 1)
+    {
+        segmentedScanRange(in, out, 0, numElements, heads, T(0));
+        return;
+    }
+
+    ScanContext<SegmentCarry<T>>& ctx = threadContext<SegmentCarry<T>>();
+
+    #pragma omp parallel num_threads(numThreads)
+    {
+        Partition part = v1::partition<T, blockPages>(omp_get_num_threads());
+        segmentedExclusiveScanTeam(ctx, in, out, numElements, heads, part);
+    }
+}
+
+/*! \brief exclusive scan of in[0:numElements] that restarts from zero where headFlags is set
+ *
+ * \a in and \a out may be identical.
+ */
+template<class T, class F>
+void segmentedExclusiveScan(const T* in, T* out, size_t numElements, const F* headFlags)
+{
+    segmentedExclusiveScanHeads(in, out, numElements, HeadFlags<F>{headFlags});
+}
+
+/*! \brief exclusive scan of in[0:numElements] that restarts from zero at each segment start
+ *
+ * \a segmentOffsets are numSegments sorted start offsets, e.g. the first numSegments entries of
+ * a CSR offset array. Offsets >= numElements are ignored, element 0 always starts a segment.
+ */
+template<class T, class I>
+void segmentedExclusiveScan(const T* in, T* out, size_t numElements, const I* segmentOffsets, size_t numSegments)
+{
+    segmentedExclusiveScanHeads(in, out, numElements, HeadOffsets<I>{segmentOffsets, numSegments});
+}
+
+/*! \brief exclusive scan of each of \a numArrays arrays stored back to back
+ *
+ * Array a is in[offsets[a]:offsets[a+1]], with offsets[0] == 0. The elements are divided evenly
+ * between the threads, such that arrays that fall into one thread's chunk are scanned whole
+ * by that thread and only arrays that cross a chunk boundary are split. The cost is that of one
+ * scan over offsets[numArrays] elements with a single barrier, independent of numArrays.
+ */
+template<class T, class I>
+void batchedExclusiveScan(const T* in, T* out, const I* offsets, size_t numArrays)
+{
+    size_t numElements = offsets[numArrays];
+    HeadOffsets<I> heads{offsets, numArrays};
+
+    int numThreads = scanThreads(numElements * sizeof(T), omp_get_max_threads());
+    if (numThreads == 1)
+    {
+        segmentedScanRange(in, out, 0, numElements, heads, T(0));
+        return;
+    }
+
+    ScanContext<SegmentCarry<T>>& ctx = threadContext<SegmentCarry<T>>();
+
+    #pragma omp parallel num_threads(numThreads)
+    {
+        Partition part = Partition::contiguous(numElements, omp_get_num_threads());
+        segmentedExclusiveScanTeam(ctx, in, out, numElements, heads, part);
+    }
+}
+
+} // namespace scan
@@ -0,0 +1,749 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Vectorized serial scan kernels with runtime ISA dispatch
+ *
+ * The kernels perform a log-step scan inside one vector register and carry the running
+ * total in a broadcast register from one vector to the next. They are written once with
+ * GCC vector extensions and instantiated for SSE4.1, AVX2 and AVX-512 through target
+ * attributes; the widest ISA supported by the CPU is selected at runtime.
+ *
+ * The scan kernels read an input type In that may be narrower than the accumulator and output
+ * type T, e.g. uint8_t counts into uint64_t offsets. Each vector of W elements of T is then
+ * loaded as W elements of In and widened in registers, such that only sizeof(In) bytes per
+ * element are read from memory.
+ *
+ * All kernels allow \a in and \a out to alias exactly (in-place scan). For floating point
+ * types the in-register scan reassociates the additions, results may therefore differ from
+ * the serial scan in the last bits.
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include <unistd.h>
+
+namespace simd
+{
+
+enum class Isa : int
+{
+    scalar = 0,
+    sse4   = 1,
+    avx2   = 2,
+    avx512 = 3
+};
+
+inline Isa detectIsa()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return Isa::avx512;
+    if (__builtin_cpu_supports("avx2")) return Isa::avx2;
+    if (__builtin_cpu_supports("sse4.1")) return Isa::sse4;
+#endif
+    return Isa::scalar;
+}
+
+//! \brief the ISA used by the kernels, detected on first use
+inline Isa isa()
+{
+    static const Isa detected = detectIsa();
+    return detected;
+}
+
+inline const char* isaName(Isa i)
+{
+    switch (i)
+    {
+        case Isa::avx512: return "avx512";
+        case Isa::avx2: return "avx2";
+        case Isa::sse4: return "sse4";
+        default: return "scalar";
+    }
+}
+
+//! \brief default software prefetch distance of the kernels in bytes, off unless measured to pay on the target machine
+constexpr size_t defaultPrefetchBytes = 0;
+
+/*! \brief software prefetch distance of the scan and reduce kernels in bytes, 0 disables prefetching
+ *
+ * The hardware prefetchers do not cross 4 KiB page boundaries, each new page starts with demand
+ * misses. Prefetching a fixed distance ahead (e.g. 1024 to 4096 bytes) keeps the loads streaming
+ * across them where the hardware does not. Initialized from SCAN_PREFETCH_BYTES, may be assigned
+ * to for tuning while no scan is running.
+ */
+inline size_t& prefetchDistance()
+{
+    static size_t distance = []()
+    {
+        const char* env = std::getenv("SCAN_PREFETCH_BYTES");
+        return env ? size_t(std::strtoull(env, nullptr, 10)) : defaultPrefetchBytes;
+    }();
+    return distance;
+}
+
+//! \brief prefetch the cache lines of [p, p + bytes) into all cache levels
+inline void prefetch(const void* p, size_t bytes)
+{
+    for (size_t b = 0; b < bytes; b += 64)
+        __builtin_prefetch(static_cast<const char*>(p) + b);
+}
+
+//! \brief types for which vector kernels exist: 32- and 64-bit integers and floats
+template<class T>
+constexpr bool isVectorizable = std::is_arithmetic_v<T> && (sizeof(T) == 4 || sizeof(T) == 8);
+
+//! \brief input types that the vector kernels widen to T: arithmetic types not wider than T
+template<class In, class T>
+constexpr bool isWidenable = isVectorizable<T> && std::is_arithmetic_v<In> && sizeof(In) <= sizeof(T);
+
+namespace detail
+{
+
+template<class T, int W>
+struct Vec
+{
+    typedef T type __attribute__((vector_size(W * sizeof(T))));
+    using mask = typename Vec<std::conditional_t<sizeof(T) == 4, int32_t, int64_t>, W>::type;
+};
+
+//! \brief shift lanes of \a x up by K, shifting in zeros
+template<class T, int W, int K>
+[[gnu::always_inline]] inline void shiftUp(typename Vec<T, W>::type& x)
+{
+    using V = typename Vec<T, W>::type;
+    typename Vec<T, W>::mask m;
+    for (int i = 0; i < W; ++i)
+        m[i] = (i >= K) ? i - K : W;
+    x = __builtin_shuffle(x, V{}, m);
+}
+
+//! \brief load W elements of In from \a in and convert them to the lanes of \a x
+template<class In, class T, int W>
+[[gnu::always_inline]] inline void loadWiden(const In* in, typename Vec<T, W>::type& x)
+{
+    if constexpr (std::is_same_v<In, T>) { std::memcpy(&x, in, sizeof(x)); }
+    else
+    {
+        typename Vec<In, W>::type narrow;
+        std::memcpy(&narrow, in, sizeof(narrow));
+        x = __builtin_convertvector(narrow, typename Vec<T, W>::type);
+    }
+}
+
+//! \brief once per cache line of \a in, prefetch in[i + distance] if it lies inside in[0:n]
+template<class In>
+[[gnu::always_inline]] inline void prefetchAhead(const In* in, size_t i, size_t distance, size_t n)
+{
+    if (distance && (i * sizeof(In)) % 64 == 0 && i + distance < n) { __builtin_prefetch(in + i + distance); }
+}
+
+//! \brief in-register inclusive scan of \a x in log2(W) steps
+template<class T, int W>
+[[gnu::always_inline]] inline void inclusiveScanRegister(typename Vec<T, W>::type& x)
+{
+    typename Vec<T, W>::type t;
+    if constexpr (W > 1) { t = x; shiftUp<T, W, 1>(t); x += t; }
+    if constexpr (W > 2) { t = x; shiftUp<T, W, 2>(t); x += t; }
+    if constexpr (W > 4) { t = x; shiftUp<T, W, 4>(t); x += t; }
+    if constexpr (W > 8) { t = x; shiftUp<T, W, 8>(t); x += t; }
+}
+
+template<class In, class T, int W>
+[[gnu::always_inline]] inline T exclusiveScanKernel(const In* in, T* out, size_t n, T init)
+{
+    using V = typename Vec<T, W>::type;
+
+    V carry = V{} + init;
+    size_t nVec = n - n % W;
+    size_t i    = 0;
+    size_t pf   = prefetchDistance() / sizeof(In);
+    for (; i < nVec; i += W)
+    {
+        V x;
+        prefetchAhead(in, i, pf, n);
+        loadWiden<In, T, W>(in + i, x);
+        inclusiveScanRegister<T, W>(x);
+
+        V excl = x;
+        shiftUp<T, W, 1>(excl);
+        excl += carry;
+        std::memcpy(out + i, &excl, sizeof(V));
+
+        carry += x[W - 1];
+    }
+
+    T sum = carry[0];
+    for (; i < n; ++i)
+    {
+        T val  = in[i];
+        out[i] = sum;
+        sum += val;
+    }
+    return sum;
+}
+
+//! \brief inclusive scan of in[0:n] into out, seeded with \a init
+template<class In, class T, int W>
+[[gnu::always_inline]] inline T inclusiveScanKernel(const In* in, T* out, size_t n, T init)
+{
+    using V = typename Vec<T, W>::type;
+
+    V carry = V{} + init;
+    size_t nVec = n - n % W;
+    size_t i    = 0;
+    size_t pf   = prefetchDistance() / sizeof(In);
+    for (; i < nVec; i += W)
+    {
+        V x;
+        prefetchAhead(in, i, pf, n);
+        loadWiden<In, T, W>(in + i, x);
+        inclusiveScanRegister<T, W>(x);
+
+        x += carry;
+        std::memcpy(out + i, &x, sizeof(V));
+
+        carry = V{} + x[W - 1];
+    }
+
+    T sum = carry[0];
+    for (; i < n; ++i)
+    {
+        sum += in[i];
+        out[i] = sum;
+    }
+    return sum;
+}
+
+template<class T, int W>
+[[gnu::always_inline]] inline void addShiftKernel(T* out, size_t n, T shift)
+{
+    using V = typename Vec<T, W>::type;
+
+    V vshift = V{} + shift;
+    size_t nVec = n - n % W;
+    size_t i    = 0;
+    for (; i < nVec; i += W)
+    {
+        V x;
+        std::memcpy(&x, out + i, sizeof(V));
+        x += vshift;
+        std::memcpy(out + i, &x, sizeof(V));
+    }
+    for (; i < n; ++i)
+        out[i] += shift;
+}
+
+//! \brief acc[0:n] += in[0:n]
+template<class T, int W>
+[[gnu::always_inline]] inline void addToKernel(T* acc, const T* in, size_t n)
+{
+    using V = typename Vec<T, W>::type;
+
+    size_t nVec = n - n % W;
+    size_t i    = 0;
+    for (; i < nVec; i += W)
+    {
+        V a, x;
+        std::memcpy(&a, acc + i, sizeof(V));
+        std::memcpy(&x, in + i, sizeof(V));
+        a += x;
+        std::memcpy(acc + i, &a, sizeof(V));
+    }
+    for (; i < n; ++i)
+        acc[i] += in[i];
+}
+
+//! \brief exclusive scan of in[0:n] into out, interleaved with adding \a shift to shiftOut[0:n]
+template<class In, class T, int W>
+[[gnu::always_inline]] inline T exclusiveScanShiftKernel(const In* in, T* out, size_t n, T* shiftOut, T shift)
+{
+    using V = typename Vec<T, W>::type;
+
+    V carry  = V{};
+    V vshift = V{} + shift;
+    size_t nVec = n - n % W;
+    size_t i    = 0;
+    size_t pf   = prefetchDistance() / sizeof(In);
+    for (; i < nVec; i += W)
+    {
+        V x;
+        prefetchAhead(in, i, pf, n);
+        loadWiden<In, T, W>(in + i, x);
+        inclusiveScanRegister<T, W>(x);
+
+        V excl = x;
+        shiftUp<T, W, 1>(excl);
+        excl += carry;
+        std::memcpy(out + i, &excl, sizeof(V));
+
+        carry += x[W - 1];
+
+        V s;
+        std::memcpy(&s, shiftOut + i, sizeof(V));
+        s += vshift;
+        std::memcpy(shiftOut + i, &s, sizeof(V));
+    }
+
+    T sum = carry[0];
+    for (; i < n; ++i)
+    {
+        T val  = in[i];
+        out[i] = sum;
+        sum += val;
+        shiftOut[i] += shift;
+    }
+    return sum;
+}
+
+//! \brief sum of in[0:n]
+template<class In, class T, int W>
+[[gnu::always_inline]] inline T reduceKernel(const In* in, size_t n)
+{
+    using V = typename Vec<T, W>::type;
+
+    V vsum      = V{};
+    size_t nVec = n - n % W;
+    size_t i    = 0;
+    size_t pf   = prefetchDistance() / sizeof(In);
+    for (; i < nVec; i += W)
+    {
+        V x;
+        prefetchAhead(in, i, pf, n);
+        loadWiden<In, T, W>(in + i, x);
+        vsum += x;
+    }
+
+    T sum = 0;
+    for (int j = 0; j < W; ++j)
+        sum += vsum[j];
+    for (; i < n; ++i)
+        sum += in[i];
+    return sum;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+//! \brief non-temporal store of \a v to the vector-aligned address \a p
+template<class V>
+[[gnu::always_inline]] inline void streamStore(void* p, const V& v)
+{
+    if constexpr (sizeof(V) == 16) { asm volatile("movntdq %1, %0" : "=m"(*(V*)p) : "x"(v)); }
+    else { asm volatile("vmovntdq %1, %0" : "=m"(*(V*)p) : "v"(v)); }
+}
+
+//! \brief exclusiveScanKernel with non-temporal stores to \a out, which must not alias \a in
+template<class In, class T, int W>
+[[gnu::always_inline]] inline T exclusiveScanStreamKernel(const In* in, T* out, size_t n, T init)
+{
+    using V = typename Vec<T, W>::type;
+
+    // scalar prologue up to the first vector-aligned output element
+    size_t i = 0;
+    for (; i < n && reinterpret_cast<uintptr_t>(out + i) % sizeof(V) != 0; ++i)
+    {
+        out[i] = init;
+        init += in[i];
+    }
+
+    V carry     = V{} + init;
+    size_t nVec = i + (n - i) - (n - i) % W;
+    size_t pf   = prefetchDistance() / sizeof(In);
+    for (; i < nVec; i += W)
+    {
+        V x;
+        prefetchAhead(in, i, pf, n);
+        loadWiden<In, T, W>(in + i, x);
+        inclusiveScanRegister<T, W>(x);
+
+        V excl = x;
+        shiftUp<T, W, 1>(excl);
+        excl += carry;
+        streamStore(out + i, excl);
+
+        carry += x[W - 1];
+    }
+
+    T sum = carry[0];
+    for (; i < n; ++i)
+    {
+        out[i] = sum;
+        sum += in[i];
+    }
+    return sum;
+}
+
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+
+template<class In, class T>
+[[gnu::target("sse4.1")]] T exclusiveScanSse4(const In* in, T* out, size_t n, T init)
+{
+    return exclusiveScanKernel<In, T, 16 / sizeof(T)>(in, out, n, init);
+}
+
+template<class In, class T>
+[[gnu::target("avx2")]] T exclusiveScanAvx2(const In* in, T* out, size_t n, T init)
+{
+    return exclusiveScanKernel<In, T, 32 / sizeof(T)>(in, out, n, init);
+}
+
+template<class In, class T>
+[[gnu::target("avx512f")]] T exclusiveScanAvx512(const In* in, T* out, size_t n, T init)
+{
+    return exclusiveScanKernel<In, T, 64 / sizeof(T)>(in, out, n, init);
+}
+
+template<class In, class T>
+[[gnu::target("sse4.1")]] T inclusiveScanSse4(const In* in, T* out, size_t n, T init)
+{
+    return inclusiveScanKernel<In, T, 16 / sizeof(T)>(in, out, n, init);
+}
+
+template<class In, class T>
+[[gnu::target("avx2")]] T inclusiveScanAvx2(const In* in, T* out, size_t n, T init)
+{
+    return inclusiveScanKernel<In, T, 32 / sizeof(T)>(in, out, n, init);
+}
+
+template<class In, class T>
+[[gnu::target("avx512f")]] T inclusiveScanAvx512(const In* in, T* out, size_t n, T init)
+{
+    return inclusiveScanKernel<In, T, 64 / sizeof(T)>(in, out, n, init);
+}
+
+template<class T>
+[[gnu::target("sse4.1")]] void addShiftSse4(T* out, size_t n, T shift)
+{
+    addShiftKernel<T, 16 / sizeof(T)>(out, n, shift);
+}
+
+template<class T>
+[[gnu::target("avx2")]] void addShiftAvx2(T* out, size_t n, T shift)
+{
+    addShiftKernel<T, 32 / sizeof(T)>(out, n, shift);
+}
+
+template<class T>
+[[gnu::target("avx512f")]] void addShiftAvx512(T* out, size_t n, T shift)
+{
+    addShiftKernel<T, 64 / sizeof(T)>(out, n, shift);
+}
+
+template<class T>
+[[gnu::target("sse4.1")]] void addToSse4(T* acc, const T* in, size_t n)
+{
+    addToKernel<T, 16 / sizeof(T)>(acc, in, n);
+}
+
+template<class T>
+[[gnu::target("avx2")]] void addToAvx2(T* acc, const T* in, size_t n)
+{
+    addToKernel<T, 32 / sizeof(T)>(acc, in, n);
+}
+
+template<class T>
+[[gnu::target("avx512f")]] void addToAvx512(T* acc, const T* in, size_t n)
+{
+    addToKernel<T, 64 / sizeof(T)>(acc, in, n);
+}
+
+template<class In, class T>
+[[gnu::target("sse4.1")]] T exclusiveScanShiftSse4(const In* in, T* out, size_t n, T* shiftOut, T shift)
+{
+    return exclusiveScanShiftKernel<In, T, 16 / sizeof(T)>(in, out, n, shiftOut, shift);
+}
+
+template<class In, class T>
+[[gnu::target("avx2")]] T exclusiveScanShiftAvx2(const In* in, T* out, size_t n, T* shiftOut, T shift)
+{
+    return exclusiveScanShiftKernel<In, T, 32 / sizeof(T)>(in, out, n, shiftOut, shift);
+}
+
+template<class In, class T>
+[[gnu::target("avx512f")]] T exclusiveScanShiftAvx512(const In* in, T* out, size_t n, T* shiftOut, T shift)
+{
+    return exclusiveScanShiftKernel<In, T, 64 / sizeof(T)>(in, out, n, shiftOut, shift);
+}
+
+template<class In, class T>
+[[gnu::target("sse4.1")]] T reduceSse4(const In* in, size_t n)
+{
+    return reduceKernel<In, T, 16 / sizeof(T)>(in, n);
+}
+
+template<class In, class T>
+[[gnu::target("avx2")]] T reduceAvx2(const In* in, size_t n)
+{
+    return reduceKernel<In, T, 32 / sizeof(T)>(in, n);
+}
+
+template<class In, class T>
+[[gnu::target("avx512f")]] T reduceAvx512(const In* in, size_t n)
+{
+    return reduceKernel<In, T, 64 / sizeof(T)>(in, n);
+}
+
+template<class In, class T>
+[[gnu::target("sse4.1")]] T exclusiveScanStreamSse4(const In* in, T* out, size_t n, T init)
+{
+    return exclusiveScanStreamKernel<In, T, 16 / sizeof(T)>(in, out, n, init);
+}
+
+template<class In, class T>
+[[gnu::target("avx2")]] T exclusiveScanStreamAvx2(const In* in, T* out, size_t n, T init)
+{
+    return exclusiveScanStreamKernel<In, T, 32 / sizeof(T)>(in, out, n, init);
+}
+
+template<class In, class T>
+[[gnu::target("avx512f")]] T exclusiveScanStreamAvx512(const In* in, T* out, size_t n, T init)
+{
+    return exclusiveScanStreamKernel<In, T, 64 / sizeof(T)>(in, out, n, init);
+}
+
+#endif
+
+} // namespace detail
+
+/*! \brief exclusive scan of in[0:n] into out[0:n], seeded with \a init
+ *
+ * \return init + sum(in[0:n]), i.e. the exclusive prefix of element n
+ */
+template<class In, class T>
+T exclusiveScan(const In* in, T* out, size_t n, T init)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if constexpr (isWidenable<In, T>)
+    {
+        switch (isa())
+        {
+            case Isa::avx512: return detail::exclusiveScanAvx512(in, out, n, init);
+            case Isa::avx2: return detail::exclusiveScanAvx2(in, out, n, init);
+            case Isa::sse4: return detail::exclusiveScanSse4(in, out, n, init);
+            default: break;
+        }
+    }
+#endif
+    for (size_t i = 0; i < n; ++i)
+    {
+        T val  = in[i];
+        out[i] = init;
+        init += val;
+    }
+    return init;
+}
+
+/*! \brief inclusive scan of in[0:n] into out[0:n], seeded with \a init
+ *
+ * \return init + sum(in[0:n]), i.e. out[n-1] for n > 0
+ */
+template<class In, class T>
+T inclusiveScan(const In* in, T* out, size_t n, T init)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if constexpr (isWidenable<In, T>)
+    {
+        switch (isa())
+        {
+            case Isa::avx512: return detail::inclusiveScanAvx512(in, out, n, init);
+            case Isa::avx2: return detail::inclusiveScanAvx2(in, out, n, init);
+            case Isa::sse4: return detail::inclusiveScanSse4(in, out, n, init);
+            default: break;
+        }
+    }
+#endif
+    for (size_t i = 0; i < n; ++i)
+    {
+        init += in[i];
+        out[i] = init;
+    }
+    return init;
+}
+
+//! \brief add \a shift to each element of out[0:n]
+template<class T>
+void addShift(T* out, size_t n, T shift)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if constexpr (isVectorizable<T>)
+    {
+        switch (isa())
+        {
+            case Isa::avx512: detail::addShiftAvx512(out, n, shift); return;
+            case Isa::avx2: detail::addShiftAvx2(out, n, shift); return;
+            case Isa::sse4: detail::addShiftSse4(out, n, shift); return;
+            default: break;
+        }
+    }
+#endif
+    for (size_t i = 0; i < n; ++i)
+        out[i] += shift;
+}
+
+//! \brief element-wise acc[0:n] += in[0:n]
+template<class T>
+void addTo(T* acc, const T* in, size_t n)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if constexpr (isVectorizable<T>)
+    {
+        switch (isa())
+        {
+            case Isa::avx512: detail::addToAvx512(acc, in, n); return;
+            case Isa::avx2: detail::addToAvx2(acc, in, n); return;
+            case Isa::sse4: detail::addToSse4(acc, in, n); return;
+            default: break;
+        }
+    }
+#endif
+    for (size_t i = 0; i < n; ++i)
+        acc[i] += in[i];
+}
+
+/*! \brief exclusive scan of in[0:n] into out[0:n] starting from 0, and shiftOut[0:n] += shift in the same loop
+ *
+ * \return sum(in[0:n])
+ *
+ * The two ranges are processed in lockstep to overlap the scan of one block with
+ * the final shift of another, see v2::exclusiveScan.
+ */
+template<class In, class T>
+T exclusiveScanShift(const In* in, T* out, size_t n, T* shiftOut, T shift)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if constexpr (isWidenable<In, T>)
+    {
+        switch (isa())
+        {
+            case Isa::avx512: return detail::exclusiveScanShiftAvx512(in, out, n, shiftOut, shift);
+            case Isa::avx2: return detail::exclusiveScanShiftAvx2(in, out, n, shiftOut, shift);
+            case Isa::sse4: return detail::exclusiveScanShiftSse4(in, out, n, shiftOut, shift);
+            default: break;
+        }
+    }
+#endif
+    T sum = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        T val  = in[i];
+        out[i] = sum;
+        sum += val;
+        shiftOut[i] += shift;
+    }
+    return sum;
+}
+
+//! \brief sum of in[0:n], accumulated in T
+template<class In, class T = In>
+T reduce(const In* in, size_t n)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if constexpr (isWidenable<In, T>)
+    {
+        switch (isa())
+        {
+            case Isa::avx512: return detail::reduceAvx512<In, T>(in, n);
+            case Isa::avx2: return detail::reduceAvx2<In, T>(in, n);
+            case Isa::sse4: return detail::reduceSse4<In, T>(in, n);
+            default: break;
+        }
+    }
+#endif
+    T sum = 0;
+    for (size_t i = 0; i < n; ++i)
+        sum += in[i];
+    return sum;
+}
+
+/*! \brief exclusiveScan with non-temporal (streaming) stores to \a out
+ *
+ * The output bypasses the caches and no read-for-ownership is issued for it. \a in and \a out
+ * must not alias. Call streamFence() before the output is read by another thread.
+ */
+template<class In, class T>
+T exclusiveScanStream(const In* in, T* out, size_t n, T init)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if constexpr (isWidenable<In, T>)
+    {
+        switch (isa())
+        {
+            case Isa::avx512: return detail::exclusiveScanStreamAvx512(in, out, n, init);
+            case Isa::avx2: return detail::exclusiveScanStreamAvx2(in, out, n, init);
+            case Isa::sse4: return detail::exclusiveScanStreamSse4(in, out, n, init);
+            default: break;
+        }
+    }
+#endif
+    return exclusiveScan(in, out, n, init);
+}
+
+//! \brief make preceding streaming stores of the calling thread globally visible
+inline void streamFence()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_sfence();
+#endif
+}
+
+//! \brief size of the last-level cache in bytes
+inline size_t llcSize()
+{
+    static const size_t size = []()
+    {
+        long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+        long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        if (l3 > 0) return size_t(l3);
+        if (l2 > 0) return size_t(l2);
+        return size_t(32) << 20;
+    }();
+    return size;
+}
+
+/*! \brief whether an out-of-place scan writing \a outputBytes should use streaming stores
+ *
+ * True if the output does not fit into the last-level cache, the threshold can be
+ * overridden with SCAN_STREAMING_BYTES.
+ */
+inline bool useStreamingStores(size_t outputBytes)
+{
+    static const size_t threshold = []()
+    {
+        const char* env = std::getenv("SCAN_STREAMING_BYTES");
+        return env ? size_t(std::strtoull(env, nullptr, 10)) : llcSize();
+    }();
+    return outputBytes > threshold;
+}
+
+} // namespace simd
@@ -0,0 +1,163 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Parallel transform scans over random-access iterators
+ *
+ * The input op(first[i]) is computed on the fly, one 4 KiB tile at a time into a stack buffer
+ * that stays in L1 and is scanned from there with the simd kernels, so no temporary input
+ * array is written or read. The transform is evaluated exactly once per element: the block
+ * carries are applied with a shift pass over the output, as in v3 while the output fits into
+ * the last-level cache and with the block-cyclic decomposition of v1 beyond.
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <algorithm>
+
+#include <omp.h>
+
+#include "scan.hpp"
+#include "scan_context.hpp"
+#include "scan_partition.hpp"
+#include "scan_simd.hpp"
+#include "scan_v1.hpp"
+
+namespace scan
+{
+
+/*! \brief inclusive or exclusive scan of op(first[b:e]) into out[b:e], seeded with \a init
+ *
+ * \return init + the sum of the transformed range
+ */
+template<bool Inclusive, class It, class T, class UnaryOp>
+T transformScanRange(It first, T* out, size_t b, size_t e, T init, const UnaryOp& op)
+{
+    constexpr size_t tileSize = 4096 / sizeof(T);
+    T tile[tileSize];
+
+    for (size_t i = b; i < e; i += tileSize)
+    {
+        size_t len = std::min(tileSize, e - i);
+        for (size_t j = 0; j < len; ++j)
+            tile[j] = op(first[i + j]);
+
+        if constexpr (Inclusive) { init = simd::inclusiveScan(tile, out + i, len, init); }
+        else { init = simd::exclusiveScan(tile, out + i, len, init); }
+    }
+    return init;
+}
+
+/*! \brief transform scan by all threads of the calling team, decomposed according to \a part
+ *
+ * Does not synchronize on exit.
+ */
+template<bool Inclusive, class It, class T, class UnaryOp>
+void transformScanTeam(ScanContext<T>& ctx, It first, T* out, size_t numElements, T init, const UnaryOp& op,
+                       const Partition& part)
+{
+    int numThreads = ctx.teamSize();
+    int tid        = omp_get_thread_num();
+
+    size_t blockSize = part.blockSize();
+    size_t nSteps    = part.numSteps(numElements);
+
+    if (tid == numThreads - 1) { ctx.carry(1, numThreads) = init; }
+
+    T stepSum = init;
+    for (size_t step = 0; step < nSteps; ++step)
+    {
+        size_t stepOffset = part.blockOffset(step, tid);
+
+        ctx.carry(step%2, tid) = transformScanRange<Inclusive>(first, out, stepOffset, stepOffset + blockSize, T(0), op);
+
+        #pragma omp barrier
+
+        T tSum = ctx.carry((step+1)%2, numThreads);
+        for (int t = 0; t < tid; ++t)
+            tSum += ctx.carry(step%2, t);
+
+        if (tid == numThreads - 1)
+        {
+            stepSum = tSum + ctx.carry(step%2, numThreads - 1);
+            ctx.carry(step%2, numThreads) = stepSum;
+        }
+
+        simd::addShift(out + stepOffset, blockSize, tSum);
+    }
+
+    // remainder
+    if (tid == numThreads - 1)
+    {
+        transformScanRange<Inclusive>(first, out, part.remainderOffset(numElements), numElements, stepSum, op);
+    }
+}
+
+template<bool Inclusive, class It, class T, class UnaryOp>
+void transformScan(It first, It last, T* out, T init, const UnaryOp& op)
+{
+    size_t numElements = last - first;
+    if (numElements == 0) { return; }
+
+    size_t bytes   = numElements * sizeof(T);
+    int numThreads = scanThreads(bytes, omp_get_max_threads());
+    if (numThreads == 1)
+    {
+        transformScanRange<Inclusive>(first, out, 0, numElements, init, op);
+        return;
+    }
+
+    ScanContext<T>& ctx = threadContext<T>();
+
+    bool inCache = bytes <= simd::llcSize();
+
+    #pragma omp parallel num_threads(numThreads)
+    {
+        int nt         = omp_get_num_threads();
+        Partition part = inCache ? Partition::contiguous(numElements, nt) : v1::partition<T, blockPages>(nt);
+        transformScanTeam<Inclusive>(ctx, first, out, numElements, init, op, part);
+    }
+}
+
+/*! \brief out[i] = init + sum(op(first[0:i])) for the random-access range [first, last)
+ *
+ * \a op is called concurrently by all threads and exactly once per element. \a out must not
+ * overlap the input range.
+ */
+template<class It, class T, class UnaryOp>
+void transformExclusiveScan(It first, It last, T* out, T init, const UnaryOp& op)
+{
+    transformScan<false>(first, last, out, init, op);
+}
+
+//! \brief out[i] = init + sum(op(first[0:i+1])) for the random-access range [first, last)
+template<class It, class T, class UnaryOp>
+void transformInclusiveScan(It first, It last, T* out, const UnaryOp& op, T init = T(0))
+{
+    transformScan<true>(first, last, out, init, op);
+}
+
+} // namespace scan
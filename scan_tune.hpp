@@ -0,0 +1,333 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Runtime selection of the scan variant and block size
+ *
+ * A set of NPages instantiations of v1 and v2, together with v3 and its reduce-then-scan form,
+ * is benchmarked on the local machine for each (element type, size class, thread count). The
+ * fastest candidate is recorded in a small text file, by default scan_tune.txt or the path in
+ * SCAN_TUNE_FILE, which is loaded on first use of tuned::exclusiveScan or of the scan::exclusiveScan
+ * front end.
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include <omp.h>
+
+#include "scan_context.hpp"
+#include "scan_v1.hpp"
+#include "scan_v2.hpp"
+#include "scan_v3.hpp"
+
+namespace scan
+{
+
+//! \brief short type tag used as key in the tuning file, e.g. u32, i64, f64
+template<class T>
+std::string typeTag()
+{
+    char kind = std::is_floating_point_v<T> ? 'f' : (std::is_signed_v<T> ? 'i' : 'u');
+    return kind + std::to_string(8 * sizeof(T));
+}
+
+//! \brief size class of a scan: log2 of the input size in bytes, rounded down
+template<class T>
+int sizeClass(size_t numElements)
+{
+    size_t bytes = std::max(numElements * sizeof(T), size_t(1));
+    return 63 - __builtin_clzll(bytes);
+}
+
+template<class T>
+struct ScanCandidate
+{
+    std::string variant;
+    int nPages;
+    void (*func)(const T*, T*, size_t);
+    //! \brief team body of the candidate, run by the front end in its own parallel region
+    void (*team)(ScanContext<T>&, const T*, T*, size_t, T);
+    //! \brief in-place team body of the candidate
+    void (*inplaceTeam)(ScanContext<T>&, T*, size_t, T);
+};
+
+namespace detail
+{
+
+template<class T>
+void reduceThenScanInplaceTeam(ScanContext<T>& ctx, T* out, size_t numElements, T init)
+{
+    v3::reduceThenScanTeam(ctx, out, out, numElements, init);
+}
+
+template<class T, int NPages>
+ScanCandidate<T> v1Candidate()
+{
+    return {"v1", NPages, v1::exclusiveScan<T, NPages>, v1::exclusiveScanTeam<T, NPages>, v1::exclusiveScanTeam<T, NPages>};
+}
+
+template<class T, int NPages>
+ScanCandidate<T> v2Candidate()
+{
+    return {"v2", NPages, v2::exclusiveScan<T, NPages>, v2::exclusiveScanTeam<T, NPages>, v2::exclusiveScanTeam<T, NPages>};
+}
+
+} // namespace detail
+
+//! \brief all precompiled instantiations the tuner chooses from
+template<class T>
+const std::vector<ScanCandidate<T>>& scanCandidates()
+{
+    using namespace detail;
+    static const std::vector<ScanCandidate<T>> candidates{
+        v1Candidate<T, 1>(),  v1Candidate<T, 2>(),  v1Candidate<T, 4>(),  v1Candidate<T, 8>(),  v1Candidate<T, 16>(),
+        v1Candidate<T, 32>(), v1Candidate<T, 64>(), v2Candidate<T, 1>(),  v2Candidate<T, 2>(),  v2Candidate<T, 4>(),
+        v2Candidate<T, 8>(),  v2Candidate<T, 16>(), v2Candidate<T, 32>(), v2Candidate<T, 64>(),
+        {"v3", 0, v3::exclusiveScan<T>, v3::exclusiveScanTeam<T, T>, v3::exclusiveScanTeam<T>},
+        {"v3rts", 0, v3::reduceThenScan<T>, v3::reduceThenScanTeam<T, T>, reduceThenScanInplaceTeam<T>},
+    };
+    return candidates;
+}
+
+//! \brief tuned (variant, NPages) per (element type, size class, thread count)
+class TuneCache
+{
+public:
+    using Key    = std::tuple<std::string, int, int>;
+    using Choice = std::pair<std::string, int>;
+
+    static std::string defaultPath()
+    {
+        const char* env = std::getenv("SCAN_TUNE_FILE");
+        return env ? env : "scan_tune.txt";
+    }
+
+    //! \brief add entries from \a path, returns false if the file cannot be read
+    bool load(const std::string& path)
+    {
+        std::ifstream fin(path);
+        if (!fin) { return false; }
+
+        std::string type, variant;
+        int sc, threads, nPages;
+        while (fin >> type >> sc >> threads >> variant >> nPages)
+        {
+            table_[Key{type, sc, threads}] = Choice{variant, nPages};
+        }
+        ++generation_;
+        return true;
+    }
+
+    bool save(const std::string& path) const
+    {
+        std::ofstream fout(path);
+        if (!fout) { return false; }
+
+        fout << "# type sizeClass(log2 bytes) threads variant nPages\n";
+        for (const auto& [key, choice] : table_)
+        {
+            fout << std::get<0>(key) << " " << std::get<1>(key) << " " << std::get<2>(key) << " " << choice.first << " "
+                 << choice.second << "\n";
+        }
+        return bool(fout);
+    }
+
+    void insert(const Key& key, const Choice& choice)
+    {
+        table_[key] = choice;
+        ++generation_;
+    }
+
+    //! \brief incremented on every change of the table, invalidates resolved dispatch entries
+    uint32_t generation() const { return generation_; }
+
+    /*! \brief return the choice for \a key
+     *
+     * Falls back to the nearest tuned size class of the same type and thread count, or to
+     * nothing if there is none.
+     */
+    std::optional<Choice> find(const Key& key) const
+    {
+        auto it = table_.find(key);
+        if (it != table_.end()) { return it->second; }
+
+        std::optional<Choice> best;
+        int bestDistance = -1;
+        for (const auto& [k, choice] : table_)
+        {
+            if (std::get<0>(k) != std::get<0>(key) || std::get<2>(k) != std::get<2>(key)) { continue; }
+            int distance = std::abs(std::get<1>(k) - std::get<1>(key));
+            if (bestDistance < 0 || distance < bestDistance)
+            {
+                best         = choice;
+                bestDistance = distance;
+            }
+        }
+        return best;
+    }
+
+    //! \brief find(key), or v3 if the type and thread count have not been tuned
+    Choice lookup(const Key& key) const { return find(key).value_or(Choice{"v3", 0}); }
+
+    size_t size() const { return table_.size(); }
+
+private:
+    std::map<Key, Choice> table_;
+    uint32_t generation_ = 0;
+};
+
+//! \brief process-wide tuning table, loaded from TuneCache::defaultPath() on first use
+inline TuneCache& tuneCache()
+{
+    static TuneCache cache = []()
+    {
+        TuneCache c;
+        c.load(TuneCache::defaultPath());
+        return c;
+    }();
+    return cache;
+}
+
+/*! \brief benchmark all candidates for scans of \a numElements elements of type T
+ *
+ * \return the fastest candidate, which is also recorded in \a cache
+ */
+template<class T>
+ScanCandidate<T> tune(TuneCache& cache, size_t numElements, int repetitions = 10)
+{
+    std::unique_ptr<T[]> in(new T[numElements]);
+    std::unique_ptr<T[]> out(new T[numElements]);
+    std::fill(in.get(), in.get() + numElements, T(1));
+    std::fill(out.get(), out.get() + numElements, T(0));
+
+    const auto& candidates = scanCandidates<T>();
+
+    double bestTime = 0;
+    size_t best     = 0;
+    for (size_t c = 0; c < candidates.size(); ++c)
+    {
+        // warmup
+        candidates[c].func(in.get(), out.get(), numElements);
+
+        double minTime = 0;
+        for (int r = 0; r < repetitions; ++r)
+        {
+            auto tp0 = std::chrono::high_resolution_clock::now();
+            candidates[c].func(in.get(), out.get(), numElements);
+            auto tp1 = std::chrono::high_resolution_clock::now();
+
+            double t = std::chrono::duration<double>(tp1 - tp0).count();
+            if (r == 0 || t < minTime) { minTime = t; }
+        }
+
+        if (c == 0 || minTime < bestTime)
+        {
+            bestTime = minTime;
+            best     = c;
+        }
+    }
+
+    cache.insert({typeTag<T>(), sizeClass<T>(numElements), omp_get_max_threads()},
+                 {candidates[best].variant, candidates[best].nPages});
+    return candidates[best];
+}
+
+namespace tuned
+{
+
+//! \brief index into scanCandidates<T>() of \a choice, or of v3 if no candidate matches
+template<class T>
+size_t candidateIndex(const TuneCache::Choice& choice)
+{
+    const auto& candidates = scanCandidates<T>();
+
+    size_t v3Index = 0;
+    for (size_t c = 0; c < candidates.size(); ++c)
+    {
+        if (candidates[c].variant == choice.first && candidates[c].nPages == choice.second) { return c; }
+        if (candidates[c].variant == "v3") { v3Index = c; }
+    }
+    return v3Index;
+}
+
+/*! \brief the tuned candidate for scans of \a numElements elements on \a numThreads threads, null if not tuned
+ *
+ * The lookup in tuneCache() is resolved once per (size class, thread count, table generation)
+ * and kept in a per-type slot per size class. The slot packs the generation, the thread count
+ * and the candidate index into one word, so the common path is one atomic load, without
+ * allocation or string comparison.
+ */
+template<class T>
+const ScanCandidate<T>* find(size_t numElements, int numThreads)
+{
+    constexpr uint64_t unresolved = 0, untuned = 0xff;
+    static std::atomic<uint64_t> slots[64];
+
+    int sc       = sizeClass<T>(numElements);
+    uint64_t key = uint64_t(tuneCache().generation()) << 24 | uint64_t(numThreads & 0xffff) << 8;
+
+    uint64_t slot = slots[sc].load(std::memory_order_relaxed);
+    if ((slot & ~uint64_t(0xff)) != key || (slot & 0xff) == unresolved)
+    {
+        auto choice = tuneCache().find({typeTag<T>(), sc, numThreads});
+        slot        = key | (choice ? candidateIndex<T>(*choice) + 1 : untuned);
+        slots[sc].store(slot, std::memory_order_relaxed);
+    }
+    return (slot & 0xff) == untuned ? nullptr : &scanCandidates<T>()[(slot & 0xff) - 1];
+}
+
+//! \brief find(), or the v3 candidate if not tuned
+template<class T>
+const ScanCandidate<T>& dispatch(size_t numElements, int numThreads)
+{
+    static const size_t v3Index = candidateIndex<T>({"v3", 0});
+
+    const ScanCandidate<T>* candidate = find<T>(numElements, numThreads);
+    return candidate ? *candidate : scanCandidates<T>()[v3Index];
+}
+
+//! \brief exclusive scan with the tuned variant and block size for this machine
+template<class T>
+void exclusiveScan(const T* in, T* out, size_t numElements)
+{
+    dispatch<T>(numElements, omp_get_max_threads()).func(in, out, numElements);
+}
+
+} // namespace tuned
+} // namespace scan
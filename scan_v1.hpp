@@ -37,130 +37,239 @@
 
 #include <omp.h>
 
-#include "scan_stl.hpp"
+#include "scan_context.hpp"
+#include "scan_partition.hpp"
+#include "scan_profile.hpp"
+#include "scan_simd.hpp"
 
 namespace v1
 {
 
+//! \brief blocks of NPages 4k pages, dealt out round-robin to the threads
 template<class T, int NPages>
-void exclusiveScan(const T* in, T* out, size_t numElements)
+scan::Partition partition(int numThreads)
 {
-    constexpr int blockSize = (NPages * 4096) / sizeof(T);
-    constexpr int clSize = 64/sizeof(T);
+    return scan::Partition::blockCyclic((NPages * scan::smallPageSize) / sizeof(T), numThreads);
+}
+
+/*! \brief exclusive scan of in[0:numElements] that writes each output element once, with streaming stores
+ *
+ * Each block is first reduced, then scanned with its final prefix as seed while its input is
+ * still in cache, so \a in is read once from memory and \a out bypasses the caches without
+ * read-for-ownership. \a in and \a out must not alias. Does not synchronize on exit.
+ */
+template<class T, int NPages, class In = T>
+void exclusiveScanStreamTeam(scan::ScanContext<T>& ctx, const In* in, T* out, size_t numElements, T init = T(0))
+{
+    constexpr int blockSize = (NPages * scan::smallPageSize) / sizeof(T);
+
+    int numThreads = ctx.teamSize();
+    int tid        = omp_get_thread_num();
 
-    constexpr int maxThreads = 256;
-    T* sb_ = (T*)aligned_alloc(4096, 2 * (maxThreads+1) * clSize * sizeof(T));
-    T (*superBlock)[maxThreads+1][clSize] = (T (*)[maxThreads+1][clSize]) sb_;  
+    scan::Partition part = partition<T, NPages>(numThreads);
+    size_t nSteps        = part.numSteps(numElements);
 
-    int numThreads = 1;
-    #pragma omp parallel
+    if (tid == numThreads - 1) { ctx.carry(1, numThreads) = init; }
+
+    SCAN_PROFILE_START();
+    T stepSum = init;
+    for (size_t step = 0; step < nSteps; ++step)
     {
-        #pragma omp single
-        numThreads = omp_get_num_threads();
+        size_t stepOffset = part.blockOffset(step, tid);
+
+        ctx.carry(step%2, tid) = simd::reduce<In, T>(in + stepOffset, blockSize);
+        SCAN_PROFILE_LAP(reduce, blockSize * sizeof(In));
 
-        int tid = omp_get_thread_num();
+        // the hardware prefetchers do not follow the jump to the next block of this thread
+        if (step + 1 < nSteps) { simd::prefetch(in + part.blockOffset(step + 1, tid), simd::prefetchDistance()); }
+
+        #pragma omp barrier
+        SCAN_PROFILE_LAP(barrier, 0);
+
+        T tSum = ctx.carry((step+1)%2, numThreads);
+        for (int t = 0; t < tid; ++t)
+            tSum += ctx.carry(step%2, t);
 
-        superBlock[0][tid][0] = 0;
-        superBlock[1][tid][0] = 0;
         if (tid == numThreads - 1)
         {
-            superBlock[0][numThreads][0] = 0;
-            superBlock[1][numThreads][0] = 0;
+            stepSum = tSum + ctx.carry(step%2, numThreads - 1);
+            ctx.carry(step%2, numThreads) = stepSum;
         }
+
+        simd::exclusiveScanStream(in + stepOffset, out + stepOffset, blockSize, tSum);
+        SCAN_PROFILE_LAP(localScan, blockSize * (sizeof(In) + sizeof(T)));
+    }
+
+    // remainder
+    if (tid == numThreads - 1)
+    {
+        size_t remOffset = part.remainderOffset(numElements);
+        simd::exclusiveScanStream(in + remOffset, out + remOffset, numElements - remOffset, stepSum);
+        SCAN_PROFILE_LAP(localScan, (numElements - remOffset) * (sizeof(In) + sizeof(T)));
     }
 
-    unsigned elementsPerStep = numThreads * blockSize;
-    unsigned nSteps = numElements / elementsPerStep;
+    simd::streamFence();
+}
 
-    #pragma omp parallel num_threads(numThreads)
+/*! \brief exclusive scan of in[0:numElements] by all threads of the calling team
+ *
+ * The input type In may be narrower than T, it is widened in the simd kernels.
+ * Outputs larger than the last-level cache are written with streaming stores, see exclusiveScanStreamTeam.
+ * Does not synchronize on exit, see exclusiveScan(ctx, in, out, numElements)
+ */
+template<class T, int NPages, class In = T>
+void exclusiveScanTeam(scan::ScanContext<T>& ctx, const In* in, T* out, size_t numElements, T init = T(0))
+{
+    if (simd::useStreamingStores(numElements * sizeof(T)))
     {
-        int tid = omp_get_thread_num();
-        for (size_t step = 0; step < nSteps; ++step)
-        {
-            size_t stepOffset = step * elementsPerStep + tid * blockSize;
+        exclusiveScanStreamTeam<T, NPages>(ctx, in, out, numElements, init);
+        return;
+    }
+
+    constexpr int blockSize = (NPages * scan::smallPageSize) / sizeof(T);
 
-            stl::exclusive_scan(in + stepOffset, in + stepOffset + blockSize, out + stepOffset, 0);
+    int numThreads = ctx.teamSize();
+    int tid        = omp_get_thread_num();
 
-            superBlock[step%2][tid][0] = out[stepOffset + blockSize - 1] + in[stepOffset + blockSize -1];
+    scan::Partition part = partition<T, NPages>(numThreads);
+    size_t nSteps        = part.numSteps(numElements);
 
-            #pragma omp barrier
+    // the running total of the previous step is read from buffer 1 in step 0, it starts at init
+    if (tid == numThreads - 1) { ctx.carry(1, numThreads) = init; }
+
+    SCAN_PROFILE_START();
+    T stepSum = init;
+    for (size_t step = 0; step < nSteps; ++step)
+    {
+        size_t stepOffset = part.blockOffset(step, tid);
 
-            T tSum = superBlock[(step+1)%2][numThreads][0];
-            for (size_t t = 0; t < tid; ++t)
-                tSum += superBlock[step%2][t][0];
+        ctx.carry(step%2, tid) = simd::exclusiveScan(in + stepOffset, out + stepOffset, blockSize, T(0));
+        SCAN_PROFILE_LAP(localScan, blockSize * (sizeof(In) + sizeof(T)));
 
-            if (tid == numThreads - 1)
-                superBlock[step%2][numThreads][0] = tSum + superBlock[step%2][numThreads - 1][0];
+        if (step + 1 < nSteps) { simd::prefetch(in + part.blockOffset(step + 1, tid), simd::prefetchDistance()); }
 
-            std::for_each(out + stepOffset, out + stepOffset + blockSize, [shift=tSum](T& val){ val += shift; });
+        #pragma omp barrier
+        SCAN_PROFILE_LAP(barrier, 0);
+
+        T tSum = ctx.carry((step+1)%2, numThreads);
+        for (int t = 0; t < tid; ++t)
+            tSum += ctx.carry(step%2, t);
+
+        if (tid == numThreads - 1)
+        {
+            stepSum = tSum + ctx.carry(step%2, numThreads - 1);
+            ctx.carry(step%2, numThreads) = stepSum;
         }
+
+        simd::addShift(out + stepOffset, blockSize, tSum);
+        SCAN_PROFILE_LAP(shift, 2 * blockSize * sizeof(T));
     }
 
     // remainder
-    T stepSum = superBlock[(nSteps+1)%2][numThreads][0];
-    stl::exclusive_scan(in + nSteps*elementsPerStep, in + numElements, out + nSteps*elementsPerStep, stepSum);
+    if (tid == numThreads - 1)
+    {
+        size_t remOffset = part.remainderOffset(numElements);
+        simd::exclusiveScan(in + remOffset, out + remOffset, numElements - remOffset, stepSum);
+        SCAN_PROFILE_LAP(localScan, (numElements - remOffset) * (sizeof(In) + sizeof(T)));
+    }
+}
+
+//! \brief exclusive scan with reusable context, callable from inside a parallel region
+template<class T, int NPages, class In = T>
+void exclusiveScan(scan::ScanContext<T>& ctx, const In* in, T* out, size_t numElements)
+{
+    scan::teamInvoke(ctx, [&]() { exclusiveScanTeam<T, NPages>(ctx, in, out, numElements); });
+}
+
+template<class T, int NPages, class In = T>
+void exclusiveScan(const In* in, T* out, size_t numElements)
+{
+    scan::ScanContext<T> ctx;
+
+    #pragma omp parallel num_threads(ctx.numThreads())
+    exclusiveScanTeam<T, NPages>(ctx, in, out, numElements);
+}
 
-    free(sb_);
+//! \brief exclusive scan with streaming stores regardless of size
+template<class T, int NPages, class In = T>
+void exclusiveScanStream(const In* in, T* out, size_t numElements)
+{
+    scan::ScanContext<T> ctx;
+
+    #pragma omp parallel num_threads(ctx.numThreads())
+    exclusiveScanStreamTeam<T, NPages>(ctx, in, out, numElements);
 }
 
 template<class T>
 T exclusiveScanSerialInplace(T* out, size_t num_elements, T init)
 {
-    T a = init;
-    T b = init;
-    for (size_t i = 0; i < num_elements; ++i)
-    {
-        a += out[i];
-        out[i] = b;
-        b = a;
-    }
-    return b;
+    return simd::exclusiveScan(out, out, num_elements, init);
 }
 
+//! \brief in-place exclusive scan of out[0:numElements] by all threads of the calling team
 template<class T, int NPages>
-void exclusiveScan(T* out, size_t numElements)
+void exclusiveScanTeam(scan::ScanContext<T>& ctx, T* out, size_t numElements, T init = T(0))
 {
-    constexpr int blockSize = (NPages * 4096) / sizeof(T);
+    constexpr int blockSize = (NPages * scan::smallPageSize) / sizeof(T);
 
-    int numThreads = 1;
-    #pragma omp parallel
-    {
-        #pragma omp single
-        numThreads = omp_get_num_threads();
-    }
+    int numThreads = ctx.teamSize();
+    int tid        = omp_get_thread_num();
 
-    T superBlock[2][numThreads+1];
-    std::fill(superBlock[0], superBlock[0] + numThreads+1, 0);
-    std::fill(superBlock[1], superBlock[1] + numThreads+1, 0);
+    scan::Partition part = partition<T, NPages>(numThreads);
+    size_t nSteps        = part.numSteps(numElements);
 
-    unsigned elementsPerStep = numThreads * blockSize;
-    unsigned nSteps = numElements / elementsPerStep;
+    if (tid == numThreads - 1) { ctx.carry(1, numThreads) = init; }
 
-    #pragma omp parallel num_threads(numThreads)
+    SCAN_PROFILE_START();
+    T stepSum = init;
+    for (size_t step = 0; step < nSteps; ++step)
     {
-        int tid = omp_get_thread_num();
-        for (size_t step = 0; step < nSteps; ++step)
-        {
-            size_t stepOffset = step * elementsPerStep + tid * blockSize;
+        size_t stepOffset = part.blockOffset(step, tid);
 
-            superBlock[step%2][tid] = exclusiveScanSerialInplace(out + stepOffset, blockSize, 0u);
+        ctx.carry(step%2, tid) = exclusiveScanSerialInplace(out + stepOffset, blockSize, T(0));
+        SCAN_PROFILE_LAP(localScan, 2 * blockSize * sizeof(T));
 
-            #pragma omp barrier
+        if (step + 1 < nSteps) { simd::prefetch(out + part.blockOffset(step + 1, tid), simd::prefetchDistance()); }
 
-            T tSum = superBlock[(step+1)%2][numThreads];
-            for (size_t t = 0; t < tid; ++t)
-                tSum += superBlock[step%2][t];
+        #pragma omp barrier
+        SCAN_PROFILE_LAP(barrier, 0);
 
-            if (tid == numThreads - 1)
-                superBlock[step%2][numThreads] = tSum + superBlock[step%2][numThreads - 1];
+        T tSum = ctx.carry((step+1)%2, numThreads);
+        for (int t = 0; t < tid; ++t)
+            tSum += ctx.carry(step%2, t);
 
-            std::for_each(out + stepOffset, out + stepOffset + blockSize, [shift=tSum](T& val){ val += shift; });
+        if (tid == numThreads - 1)
+        {
+            stepSum = tSum + ctx.carry(step%2, numThreads - 1);
+            ctx.carry(step%2, numThreads) = stepSum;
         }
+
+        simd::addShift(out + stepOffset, blockSize, tSum);
+        SCAN_PROFILE_LAP(shift, 2 * blockSize * sizeof(T));
     }
 
     // remainder
-    T stepSum = superBlock[(nSteps+1)%2][numThreads];
-    exclusiveScanSerialInplace(out + nSteps*elementsPerStep, numElements - nSteps*elementsPerStep, stepSum);
+    if (tid == numThreads - 1)
+    {
+        size_t remOffset = part.remainderOffset(numElements);
+        exclusiveScanSerialInplace(out + remOffset, numElements - remOffset, stepSum);
+        SCAN_PROFILE_LAP(localScan, 2 * (numElements - remOffset) * sizeof(T));
+    }
+}
+
+template<class T, int NPages>
+void exclusiveScan(scan::ScanContext<T>& ctx, T* out, size_t numElements)
+{
+    scan::teamInvoke(ctx, [&]() { exclusiveScanTeam<T, NPages>(ctx, out, numElements); });
+}
+
+template<class T, int NPages>
+void exclusiveScan(T* out, size_t numElements)
+{
+    scan::ScanContext<T> ctx;
+
+    #pragma omp parallel num_threads(ctx.numThreads())
+    exclusiveScanTeam<T, NPages>(ctx, out, numElements);
 }
 
 } // namespace v1
@@ -36,91 +36,162 @@
 
 #include <omp.h>
 
-#include "scan_stl.hpp"
+#include "scan_context.hpp"
+#include "scan_partition.hpp"
+#include "scan_profile.hpp"
+#include "scan_simd.hpp"
+#include "scan_v1.hpp"
 
 namespace v2
 {
 
+//! \brief same block mapping as v1
 template<class T, int NPages>
-void exclusiveScan(const T* in, T* out, size_t numElements)
+scan::Partition partition(int numThreads)
 {
-    constexpr int blockSize = (NPages * 4096) / sizeof(T);
+    return scan::Partition::blockCyclic((NPages * scan::smallPageSize) / sizeof(T), numThreads);
+}
+
+/*! \brief interleaved prescan and shift of in[0:numElements] by all threads of the calling team
+ *
+ * \a in and \a out may be identical: each block is read by the prescan before it is written,
+ * and the shift of step s-1 only touches output blocks whose input has been consumed.
+ * Does not synchronize on exit.
+ */
+template<class T, int NPages, class In = T>
+void exclusiveScanInterleavedTeam(scan::ScanContext<T>& ctx, const In* in, T* out, size_t numElements, T init)
+{
+    constexpr int blockSize = (NPages * scan::smallPageSize) / sizeof(T);
 
-    int numThreads = 1;
-    #pragma omp parallel
+    int numThreads = ctx.teamSize();
+    int tid        = omp_get_thread_num();
+
+    scan::Partition part = partition<T, NPages>(numThreads);
+    size_t nSteps        = part.numSteps(numElements);
+
+    // step 0
+    SCAN_PROFILE_START();
+    if (tid == numThreads - 1) { ctx.carry(1, numThreads) = init; }
+    if (nSteps > 0)
     {
-        #pragma omp single
-        numThreads = omp_get_num_threads();
-    }
+        size_t stepOffset = part.blockOffset(0, tid);
 
-    T superBlock[2][numThreads+1];
-    std::fill(superBlock[0], superBlock[0] + numThreads+1, 0);
-    std::fill(superBlock[1], superBlock[1] + numThreads+1, 0);
+        ctx.carry(0, tid) = simd::exclusiveScan(in + stepOffset, out + stepOffset, blockSize, T(0));
+        SCAN_PROFILE_LAP(localScan, blockSize * (sizeof(In) + sizeof(T)));
 
-    unsigned elementsPerStep = numThreads * blockSize;
-    unsigned nSteps = numElements / elementsPerStep;
+        if (nSteps > 1) { simd::prefetch(in + part.blockOffset(1, tid), simd::prefetchDistance()); }
+    }
+    #pragma omp barrier
+    SCAN_PROFILE_LAP(barrier, 0);
 
-    #pragma omp parallel num_threads(numThreads)
+    for (size_t step = 1; step < nSteps; ++step)
     {
-        int tid = omp_get_thread_num();
+        size_t stepOffset  = part.blockOffset(step, tid);
+        size_t shiftOffset = part.blockOffset(step-1, tid);
+
+        T tShiftSum = ctx.carry(step%2, numThreads);
+        for (int t = 0; t < tid; ++t)
+            tShiftSum += ctx.carry((step+1)%2, t);
 
-        // step 0
-        if (nSteps > 0)
-        {
-            size_t stepOffset = tid * blockSize;
+        if (tid == numThreads - 1)
+            ctx.carry((step+1)%2, numThreads) = tShiftSum + ctx.carry((step+1)%2, numThreads - 1);
+
+        // interleave pre-scanning of <step> block with shifting <step-1> block by previous superBlock sum
+        ctx.carry(step%2, tid) =
+            simd::exclusiveScanShift(in + stepOffset, out + stepOffset, blockSize, out + shiftOffset, tShiftSum);
+        SCAN_PROFILE_LAP(localScan, blockSize * (sizeof(In) + 3 * sizeof(T)));
+
+        if (step + 1 < nSteps) { simd::prefetch(in + part.blockOffset(step + 1, tid), simd::prefetchDistance()); }
 
-            stl::exclusive_scan(in + stepOffset, in + stepOffset + blockSize, out + stepOffset, 0);
-            superBlock[0][tid] = out[stepOffset + blockSize - 1] + in[stepOffset + blockSize - 1];
-        }
         #pragma omp barrier
+        SCAN_PROFILE_LAP(barrier, 0);
+    }
+
+    // last step
+    T stepSum = init;
+    if (nSteps > 0)
+    {
+        T tSum = ctx.carry(nSteps%2, numThreads);
+        for (int t = 0; t < tid; ++t)
+            tSum += ctx.carry((nSteps+1)%2, t);
 
-        for (size_t step = 1; step < nSteps; ++step)
-        {
-            size_t stepOffset  = step * elementsPerStep + tid * blockSize;
-            size_t shiftOffset = (step-1) * elementsPerStep + tid * blockSize;
+        if (tid == numThreads - 1)
+            stepSum = tSum + ctx.carry((nSteps+1)%2, numThreads - 1);
 
-            size_t tShiftSum = superBlock[step%2][numThreads];
-            for (size_t t = 0; t < tid; ++t)
-                tShiftSum += superBlock[(step+1)%2][t];
+        size_t stepOffset = part.blockOffset(nSteps-1, tid);
+        simd::addShift(out + stepOffset, blockSize, tSum);
+        SCAN_PROFILE_LAP(shift, 2 * blockSize * sizeof(T));
+    }
 
-            if (tid == numThreads - 1)
-                superBlock[(step+1)%2][numThreads] = tShiftSum + superBlock[(step+1)%2][numThreads - 1];
+    // remainder
+    if (tid == numThreads - 1)
+    {
+        size_t remOffset = part.remainderOffset(numElements);
+        simd::exclusiveScan(in + remOffset, out + remOffset, numElements - remOffset, stepSum);
+        SCAN_PROFILE_LAP(localScan, (numElements - remOffset) * (sizeof(In) + sizeof(T)));
+    }
+}
 
-            // interleave pre-scanning of <step> block with shifting <step-1> block by previous superBlock sum
-            T tLocalSum = 0;
-            for (size_t ib = 0; ib < blockSize; ++ib)
-            {
-                size_t i = stepOffset + ib;
+/*! \brief exclusive scan of in[0:numElements] by all threads of the calling team
+ *
+ * The input type In may be narrower than T. Outputs larger than the last-level cache are
+ * written once with streaming stores. \a in and \a out must not alias, see the in-place overload.
+ * Does not synchronize on exit, see exclusiveScan(ctx, in, out, numElements)
+ */
+template<class T, int NPages, class In = T>
+void exclusiveScanTeam(scan::ScanContext<T>& ctx, const In* in, T* out, size_t numElements, T init = T(0))
+{
+    // with streaming stores the interleaved shift would write each output twice, use v1's write-once pipeline
+    if (simd::useStreamingStores(numElements * sizeof(T)))
+    {
+        v1::exclusiveScanStreamTeam<T, NPages>(ctx, in, out, numElements, init);
+        return;
+    }
 
-                out[i] = tLocalSum;
-                tLocalSum += in[i];
+    exclusiveScanInterleavedTeam<T, NPages>(ctx, in, out, numElements, init);
+}
 
-                size_t iShift = shiftOffset + ib;
-                out[iShift] += tShiftSum;
-            }
+//! \brief exclusive scan with reusable context, callable from inside a parallel region
+template<class T, int NPages, class In = T>
+void exclusiveScan(scan::ScanContext<T>& ctx, const In* in, T* out, size_t numElements)
+{
+    scan::teamInvoke(ctx, [&]() { exclusiveScanTeam<T, NPages>(ctx, in, out, numElements); });
+}
 
-            superBlock[step%2][tid] = tLocalSum;
+template<class T, int NPages, class In = T>
+void exclusiveScan(const In* in, T* out, size_t numElements)
+{
+    scan::ScanContext<T> ctx;
 
-            #pragma omp barrier
-        }
+    #pragma omp parallel num_threads(ctx.numThreads())
+    exclusiveScanTeam<T, NPages>(ctx, in, out, numElements);
+}
 
-        // last step
-        if (nSteps > 0)
-        {
-            size_t tSum = superBlock[nSteps%2][numThreads];
-            for (size_t t = 0; t < tid; ++t)
-                tSum += superBlock[(nSteps+1)%2][t];
+/*! \brief in-place exclusive scan of out[0:numElements] by all threads of the calling team
+ *
+ * Same pipeline as the out-of-place scan below the streaming threshold, for all sizes: the
+ * output lines are the input lines, which the prescan has just brought into the cache, so
+ * streaming stores would not save a read-for-ownership.
+ */
+template<class T, int NPages>
+void exclusiveScanTeam(scan::ScanContext<T>& ctx, T* out, size_t numElements, T init = T(0))
+{
+    exclusiveScanInterleavedTeam<T, NPages>(ctx, out, out, numElements, init);
+}
 
-            if (tid == numThreads - 1)
-                superBlock[(nSteps+1)%2][numThreads] = tSum + superBlock[(nSteps+1)%2][numThreads - 1];
+template<class T, int NPages>
+void exclusiveScan(scan::ScanContext<T>& ctx, T* out, size_t numElements)
+{
+    scan::teamInvoke(ctx, [&]() { exclusiveScanTeam<T, NPages>(ctx, out, numElements); });
+}
 
-            size_t stepOffset = (nSteps-1) * elementsPerStep + tid * blockSize;
-            std::for_each(out + stepOffset, out + stepOffset + blockSize, [shift=tSum](T& val){ val += shift; });
-        }
-    }
+template<class T, int NPages>
+void exclusiveScan(T* out, size_t numElements)
+{
+    scan::ScanContext<T> ctx;
 
-    T stepSum = superBlock[(nSteps+1)%2][numThreads];
-    stl::exclusive_scan(in + nSteps*elementsPerStep, in + numElements, out + nSteps*elementsPerStep, stepSum);
+    #pragma omp parallel num_threads(ctx.numThreads())
+    exclusiveScanTeam<T, NPages>(ctx, out, numElements);
 }
 
 } // namespace v2
@@ -37,51 +37,172 @@
 
 #include <omp.h>
 
-#include "scan_stl.hpp"
+#include "scan_bandwidth.hpp"
+#include "scan_context.hpp"
+#include "scan_partition.hpp"
+#include "scan_profile.hpp"
+#include "scan_simd.hpp"
 
 namespace v3
 {
 
-template<class T>
-void exclusiveScan(const T* in, T* out, size_t numElements)
+//! \brief one contiguous chunk per thread, the last chunk includes the remainder
+inline scan::Partition partition(size_t numElements, int numThreads)
 {
-    constexpr int clSize = 64/sizeof(T);
+    return scan::Partition::contiguous(numElements, numThreads);
+}
+
+/*! \brief exclusive scan of in[0:numElements] by all threads of the calling team
+ *
+ * Each thread scans one contiguous chunk, the last thread's chunk includes the remainder.
+ * The input type In may be narrower than T. \a in and \a out may be identical, as each thread
+ * reads and writes only its own chunk. Does not synchronize on exit, see exclusiveScan(ctx, in, out, numElements)
+ */
+template<class In, class T>
+void exclusiveScanTeam(scan::ScanContext<T>& ctx, const In* in, T* out, size_t numElements, T init = T(0))
+{
+    int numThreads = ctx.teamSize();
+    int tid        = omp_get_thread_num();
+
+    scan::Partition part = partition(numElements, numThreads);
 
-    constexpr int maxThreads = 256;
-    alignas(64) T superBlock[maxThreads][clSize];
+    size_t threadOffset = part.blockOffset(0, tid);
+    size_t threadEnd    = (tid == numThreads - 1) ? numElements : threadOffset + part.blockSize();
 
-    int numThreads = 1;
-    #pragma omp parallel
+    size_t chunkSize = threadEnd - threadOffset;
+
+    SCAN_PROFILE_START();
+    ctx.carry(0, tid) = simd::exclusiveScan(in + threadOffset, out + threadOffset, chunkSize, T(0));
+    SCAN_PROFILE_LAP(localScan, chunkSize * (sizeof(In) + sizeof(T)));
+
+    #pragma omp barrier
+    SCAN_PROFILE_LAP(barrier, 0);
+
+    T tSum = init;
+    for (int t = 0; t < tid; ++t)
+        tSum += ctx.carry(0, t);
+
+    simd::addShift(out + threadOffset, chunkSize, tSum);
+    SCAN_PROFILE_LAP(shift, 2 * chunkSize * sizeof(T));
+}
+
+/*! \brief reduce-then-scan of in[0:numElements] by all threads of the calling team
+ *
+ * Each thread reduces its chunk, the chunk sums are scanned and each chunk is then scanned
+ * once more with its final prefix as seed. The input is read twice, but each output element is
+ * written exactly once, with streaming stores if the output exceeds the last-level cache and
+ * does not alias the input. \a in and \a out may be identical. Does not synchronize on exit.
+ */
+template<class In, class T>
+void reduceThenScanTeam(scan::ScanContext<T>& ctx, const In* in, T* out, size_t numElements, T init = T(0))
+{
+    int numThreads = ctx.teamSize();
+    int tid        = omp_get_thread_num();
+
+    scan::Partition part = partition(numElements, numThreads);
+
+    size_t threadOffset = part.blockOffset(0, tid);
+    size_t threadEnd    = (tid == numThreads - 1) ? numElements : threadOffset + part.blockSize();
+
+    size_t chunkSize = threadEnd - threadOffset;
+
+    SCAN_PROFILE_START();
+    ctx.carry(0, tid) = simd::reduce<In, T>(in + threadOffset, chunkSize);
+    SCAN_PROFILE_LAP(reduce, chunkSize * sizeof(In));
+
+    #pragma omp barrier
+    SCAN_PROFILE_LAP(barrier, 0);
+
+    T tSum = init;
+    for (int t = 0; t < tid; ++t)
+        tSum += ctx.carry(0, t);
+
+    // the streaming kernel stores an element before it reads it, which is wrong in place
+    bool inPlace = static_cast<const void*>(in) == static_cast<const void*>(out);
+    if (!inPlace && simd::useStreamingStores(numElements * sizeof(T)))
     {
-        #pragma omp single 
-        numThreads = omp_get_num_threads();
+        simd::exclusiveScanStream(in + threadOffset, out + threadOffset, chunkSize, tSum);
+        simd::streamFence();
     }
+    else { simd::exclusiveScan(in + threadOffset, out + threadOffset, chunkSize, tSum); }
+    SCAN_PROFILE_LAP(localScan, chunkSize * (sizeof(In) + sizeof(T)));
+}
 
-    size_t elementsPerThread = numElements / numThreads;
+//! \brief exclusive scan with reusable context, callable from inside a parallel region
+template<class In, class T>
+void exclusiveScan(scan::ScanContext<T>& ctx, const In* in, T* out, size_t numElements)
+{
+    scan::teamInvoke(ctx, [&]() { exclusiveScanTeam(ctx, in, out, numElements); });
+}
 
-    #pragma omp parallel num_threads(numThreads)
-    {
+template<class In, class T>
+void exclusiveScan(const In* in, T* out, size_t numElements)
+{
+    scan::ScanContext<T> ctx;
 
-        int tid = omp_get_thread_num();
+    #pragma omp parallel num_threads(ctx.numThreads())
+    exclusiveScanTeam(ctx, in, out, numElements);
+}
 
-        size_t threadOffset = tid * elementsPerThread;
-        stl::exclusive_scan(in + threadOffset, in + threadOffset + elementsPerThread, out + threadOffset, T(0));
+template<class In, class T>
+void reduceThenScan(scan::ScanContext<T>& ctx, const In* in, T* out, size_t numElements)
+{
+    scan::teamInvoke(ctx, [&]() { reduceThenScanTeam(ctx, in, out, numElements); });
+}
 
-        superBlock[tid][0] = out[threadOffset + elementsPerThread - 1] + in[threadOffset + elementsPerThread -1];
+template<class In, class T>
+void reduceThenScan(const In* in, T* out, size_t numElements)
+{
+    scan::ScanContext<T> ctx;
 
-        #pragma omp barrier
+    #pragma omp parallel num_threads(ctx.numThreads())
+    reduceThenScanTeam(ctx, in, out, numElements);
+}
 
-        T tSum = 0;
-        for (int t = 0; t < tid; ++t)
-            tSum += superBlock[t][0];
+//! \brief in-place exclusive scan of out[0:numElements] by all threads of the calling team
+template<class T>
+void exclusiveScanTeam(scan::ScanContext<T>& ctx, T* out, size_t numElements, T init = T(0))
+{
+    exclusiveScanTeam(ctx, static_cast<const T*>(out), out, numElements, init);
+}
 
-        std::for_each(out + threadOffset, out + threadOffset + elementsPerThread, [shift=tSum](T& val){ val += shift; });
-    }
+template<class T>
+void exclusiveScan(scan::ScanContext<T>& ctx, T* out, size_t numElements)
+{
+    scan::teamInvoke(ctx, [&]() { exclusiveScanTeam(ctx, out, numElements); });
+}
 
-    // remainder
-    size_t nDone = numThreads * elementsPerThread;
-    T stepSum = out[nDone - 1] + in[nDone - 1];
-    stl::exclusive_scan(in + nDone, in + numElements, out + nDone, stepSum);
+template<class T>
+void exclusiveScan(T* out, size_t numElements)
+{
+    scan::ScanContext<T> ctx;
+
+    #pragma omp parallel num_threads(ctx.numThreads())
+    exclusiveScanTeam(ctx, out, numElements);
+}
+
+//! \brief whether reduce-then-scan is predicted to be faster than the shift pass for \a numElements
+template<class T>
+bool preferReduceThenScan(size_t numElements)
+{
+    size_t bytes = numElements * sizeof(T);
+    const scan::Bandwidth& bw = scan::memoryBandwidth();
+    return scan::reduceThenScanTime(bytes, bw, simd::llcSize(), simd::useStreamingStores(bytes)) <
+           scan::shiftScanTime(bytes, bw, simd::llcSize());
+}
+
+//! \brief v3 with shift pass or reduce-then-scan, whichever moves less data at scan::memoryBandwidth()
+template<class T>
+void exclusiveScanAdaptive(const T* in, T* out, size_t numElements)
+{
+    scan::ScanContext<T> ctx;
+
+    bool rts = preferReduceThenScan<T>(numElements);
+    #pragma omp parallel num_threads(ctx.numThreads())
+    {
+        if (rts) { reduceThenScanTeam(ctx, in, out, numElements); }
+        else { exclusiveScanTeam(ctx, in, out, numElements); }
+    }
 }
 
 } // namespace v3
@@ -0,0 +1,184 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Sebastian Keller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! \file
+ * \brief Single-pass parallel prefix sum with decoupled look-back
+ *
+ * Tiles are claimed in order through an atomic counter. Each tile first reduces its input,
+ * publishes the aggregate, then walks back over the status flags of its predecessors until
+ * it finds an inclusive prefix. The tile's input is still in cache when it is finally scanned
+ * with the resolved prefix as seed, so input is read once from memory, output written once
+ * and no thread ever waits at a barrier.
+ *
+ * \author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <utility>
+
+#include <omp.h>
+
+#include "scan_simd.hpp"
+
+namespace v4
+{
+
+/*! \brief look-back status of a tile, padded to one cache line
+ *
+ * The flag holds the state in its low two bits and the epoch of the scan that set it above,
+ * flags left over from an earlier scan read as invalid.
+ */
+template<class T>
+struct alignas(64) TileStatus
+{
+    enum : uint64_t { invalid = 0, aggregate = 1, prefix = 2 };
+
+    std::atomic<uint64_t> flag{invalid};
+    T tileAggregate;
+    T inclusivePrefix;
+};
+
+//! \brief tile status array reused across the scans of the calling thread, grown on demand
+template<class T>
+class TileStatusBuffer
+{
+public:
+    //! \brief status for \a numTiles tiles, all invalid for the returned epoch
+    std::pair<TileStatus<T>*, uint64_t> acquire(size_t numTiles)
+    {
+        if (numTiles > capacity_)
+        {
+            status_.reset(new TileStatus<T>[numTiles]);
+            capacity_ = numTiles;
+        }
+        return {status_.get(), ++epoch_};
+    }
+
+private:
+    std::unique_ptr<TileStatus<T>[]> status_;
+    size_t capacity_ = 0;
+    uint64_t epoch_  = 0;
+};
+
+template<class T>
+TileStatusBuffer<T>& tileStatusBuffer()
+{
+    static thread_local TileStatusBuffer<T> buffer;
+    return buffer;
+}
+
+//! \brief return the exclusive prefix of tile \a tile, walking back over its predecessors
+template<class T>
+T lookBack(const TileStatus<T>* status, size_t tile, uint64_t epoch)
+{
+    T exclusive = 0;
+    for (size_t p = tile; p > 0; --p)
+    {
+        const TileStatus<T>& pred = status[p - 1];
+
+        uint64_t flag;
+        while ((flag = pred.flag.load(std::memory_order_acquire)) >> 2 != epoch)
+            ;
+
+        if ((flag & 3) == TileStatus<T>::prefix)
+        {
+            exclusive += pred.inclusivePrefix;
+            break;
+        }
+        exclusive += pred.tileAggregate;
+    }
+    return exclusive;
+}
+
+/*! \brief single-pass scan of in[0:numElements]
+ *
+ * With \a streaming, tiles are written with non-temporal stores, in and out must not alias.
+ */
+template<class T, int NPages>
+void exclusiveScanImpl(const T* in, T* out, size_t numElements, bool streaming, T init = T(0))
+{
+    constexpr size_t tileSize = (NPages * 4096) / sizeof(T);
+
+    size_t numTiles       = (numElements + tileSize - 1) / tileSize;
+    auto acquired         = tileStatusBuffer<T>().acquire(numTiles);
+    TileStatus<T>* status = acquired.first;
+    uint64_t epoch        = acquired.second;
+
+    std::atomic<size_t> tileCounter{0};
+
+    #pragma omp parallel
+    {
+        for (size_t tile = tileCounter++; tile < numTiles; tile = tileCounter++)
+        {
+            size_t tileOffset = tile * tileSize;
+            size_t tileEnd    = std::min(tileOffset + tileSize, numElements);
+
+            T tileSum = simd::reduce<T, T>(in + tileOffset, tileEnd - tileOffset);
+
+            TileStatus<T>& self = status[tile];
+            T exclusive = init;
+            if (tile == 0)
+            {
+                self.inclusivePrefix = init + tileSum;
+                self.flag.store(epoch << 2 | TileStatus<T>::prefix, std::memory_order_release);
+            }
+            else
+            {
+                self.tileAggregate = tileSum;
+                self.flag.store(epoch << 2 | TileStatus<T>::aggregate, std::memory_order_release);
+
+                exclusive = lookBack(status, tile, epoch);
+
+                self.inclusivePrefix = exclusive + tileSum;
+                self.flag.store(epoch << 2 | TileStatus<T>::prefix, std::memory_order_release);
+            }
+
+            if (streaming) { simd::exclusiveScanStream(in + tileOffset, out + tileOffset, tileEnd - tileOffset, exclusive); }
+            else { simd::exclusiveScan(in + tileOffset, out + tileOffset, tileEnd - tileOffset, exclusive); }
+        }
+
+        if (streaming) { simd::streamFence(); }
+    }
+}
+
+//! \brief single-pass scan, outputs larger than the last-level cache are written with streaming stores
+template<class T, int NPages>
+void exclusiveScan(const T* in, T* out, size_t numElements)
+{
+    exclusiveScanImpl<T, NPages>(in, out, numElements, simd::useStreamingStores(numElements * sizeof(T)));
+}
+
+//! \brief single-pass scan with streaming stores regardless of size
+template<class T, int NPages>
+void exclusiveScanStream(const T* in, T* out, size_t numElements)
+{
+    exclusiveScanImpl<T, NPages>(in, out, numElements, true);
+}
+
+} // namespace v4
@@ -61,8 +61,9 @@ void test_scan(std::string name, const T* input, T* output, size_t numElements,
     }
 }
 
+//! \brief returns the measured read+write bandwidth in MB/s, see bench.cpp for a full sweep
 template<class T>
-void benchmark_scan(std::string name, const T* input, T* output, size_t numElements, const std::vector<T>& reference,
+double benchmark_scan(std::string name, const T* input, T* output, size_t numElements, const std::vector<T>& reference,
                     void(*func)(const T*, T*, std::size_t))
 {
     int repetitions = 30;
@@ -79,5 +80,9 @@ void benchmark_scan(std::string name, const T* input, T* output, size_t numEleme
 
     double t0 = std::chrono::duration<double>(tp1 - tp0).count();
 
-    std::cout << name << " benchmark bandwidth: " << numElements * sizeof(unsigned) / (t0 * 1e6) * repetitions << " MB/s\n";
+    // bytes read from the input plus bytes written to the output
+    double bandwidth = 2 * numElements * sizeof(T) / (t0 * 1e6) * repetitions;
+    std::cout << name << " benchmark read+write bandwidth: " << bandwidth << " MB/s\n";
+
+    return bandwidth;
 }